@@ -0,0 +1,31 @@
+#ifndef _MIPS_TLBPOLICY_H_
+#define _MIPS_TLBPOLICY_H_
+
+/*
+ * TLB replacement policy, chosen at build time by setting TLBPOLICY.
+ * This is used once every TLB slot holds a valid entry:
+ *
+ *     TLBPOLICY_RANDOM     - the hardware Random register (tlb_random).
+ *                            The only policy the refill fast path in
+ *                            exception-mips1.S can follow, so it is
+ *                            compiled out under the others.
+ *     TLBPOLICY_ROUNDROBIN - replace slots in order.
+ *     TLBPOLICY_CLOCK      - sweep the slots in order, sparing each
+ *                            referenced one once. A slot is referenced
+ *                            if the page loaded into it had been
+ *                            loaded before or has been written through
+ *                            it, i.e. the page has a history of faults.
+ *
+ * Each policy counts its replacements separately in uw-vmstats.
+ *
+ * No C in here: exception-mips1.S includes it.
+ */
+
+#define TLBPOLICY_RANDOM	0
+#define TLBPOLICY_ROUNDROBIN	1
+#define TLBPOLICY_CLOCK		2
+
+#define TLBPOLICY	TLBPOLICY_RANDOM
+
+
+#endif /* _MIPS_TLBPOLICY_H_ */
@@ -89,6 +89,16 @@
  */
 #define USERSTACK     USERSPACETOP
 
+#if OPT_A3 // growable stack
+/*
+ * The user stack starts out USERSTACK_INITPAGES pages long and grows
+ * down on demand, one fault at a time, to at most USERSTACK_MAXSIZE
+ * bytes below USERSTACK.
+ */
+#define USERSTACK_INITPAGES  1
+#define USERSTACK_MAXSIZE    (4 * 1024 * 1024)
+#endif
+
 /*
  * Interface to the low-level module that looks after the amount of
  * physical memory we have.
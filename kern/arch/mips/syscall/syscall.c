@@ -35,8 +35,10 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <kmem.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 ///////
 #include <addrspace.h>
@@ -148,6 +150,25 @@ syscall(struct trapframe *tf)
 	    err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 		break;
 #endif
+
+#if OPT_A3
+	case SYS_sbrk:
+	    err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+		break;
+
+	case SYS_mmap:
+	    err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			   (int)tf->tf_a2, (int)tf->tf_a3, (vaddr_t *)&retval);
+		break;
+
+	case SYS_munmap:
+	    err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	case SYS___getvmstat:
+	    err = sys___getvmstat((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+#endif
  
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
@@ -192,11 +213,15 @@ syscall(struct trapframe *tf)
  *
  * Thus, you can trash it and do things another way if you prefer.
  */
+struct kmem_cache trapframe_cache =
+	KMEM_CACHE_INITIALIZER("trapframe", struct trapframe, NULL, NULL);
+
 void
 enter_forked_process(struct trapframe *tf)
 {
     #if OPT_A2
     struct trapframe new_tf = *tf;
+    kmem_cache_free(&trapframe_cache, tf); // sys_fork's copy is done with
     new_tf.tf_a3 = 0;   //  set results success code on return to 0
     new_tf.tf_v0 = 0;   //  set return value on return to 0
     new_tf.tf_epc += 4; // program counter incresed by 4
@@ -34,12 +34,26 @@
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
+#include <thread.h>
+#include <kmem.h>
 #include <mips/tlb.h>
+#include <mips/tlbpolicy.h>
 #include <addrspace.h>
 #include <vm.h>
 
 #include "opt-A3.h"
 #include <array.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <uw-vmstats.h>
+#include <coremap.h>
+#include <cpu.h>
+#include <swap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <kern/mman.h>
+#include <platform/maxcpus.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -55,94 +69,120 @@
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
 #if OPT_A3 // managing Memory
-static struct spinlock coremap_stealmem_lock = SPINLOCK_INITIALIZER;
-static int* coremap;
-static paddr_t coremap_firstaddr = 0;
-static paddr_t coremap_lastaddr = 0;
+// set once the coremap (see vm/coremap.c) owns physical memory
 static bool bootstrap = false;
 #endif
 
+#if OPT_A3 // ASIDs
+/*
+ * ASIDs are handed out in order from 1. When they run out, a new
+ * generation starts: every address space gets a fresh ASID the next
+ * time it is activated, and every cpu flushes its TLB once before
+ * running anything with a new-generation ASID.
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1;
+static uint32_t asid_next = 1;
+#endif
 
-void
-vm_bootstrap(void)
-{
-#if OPT_A3 // Managing Memory
-
-	// call ram_getsize to get the remaining physical memory in the system
-	ram_getsize(&coremap_firstaddr, &coremap_lastaddr);
-    
-	// calculate number of pages needs for coremap
-	int valid_page_num = (coremap_lastaddr - coremap_firstaddr) / PAGE_SIZE; // unsisgned
-
-    // get the ptr to coremap
-	coremap = (int*) PADDR_TO_KVADDR(coremap_firstaddr);
-
-    // initialize the coremap: every page is not use
-	for (int i = 0; i < valid_page_num; i++) {
-		coremap[i] = 0;
-  	}
-	
-	// update bool 
-	bootstrap = true;
+#if OPT_A3 // TLB refill fast path
+/*
+ * The page table of the address space active on each cpu, for the
+ * UTLB handler in exception-mips1.S; 0 when there is none.
+ */
+vaddr_t cpupagetables[MAXCPUS];
 #endif
-}
 
+#if OPT_A3 // fault-around
+// pages preloaded around a TLB miss, 0 for none (see vm.h)
+unsigned vm_faultaround = 0;
+#endif
 
-#if OPT_A3 // Managing Memory 
+#if OPT_A3 // TLB replacement
+/*
+ * Mark TLB slot I of this cpu referenced or not, for the clock
+ * policy. Interrupts must be off.
+ */
+static
+void
+tlb_setref(int i, bool referenced)
+{
+	uint64_t bit = (uint64_t)1 << i;
 
-// change the contents of coremap from unused pages to continuous used pages
-static void write_to_coremap(unsigned long npages, int start_idx) {
-	for (unsigned long j = 1; j <= npages; j++) {
-		coremap[start_idx + j - 1] = (int) j;
-    }
+	if (referenced) {
+		curcpu->c_tlbref |= bit;
+	}
+	else {
+		curcpu->c_tlbref &= ~bit;
+	}
 }
 
+/*
+ * Pick the TLB slot to replace when none is free, according to
+ * TLBPOLICY (see mips/tlbpolicy.h). Returns -1 if tlb_random should
+ * pick it. Interrupts must be off.
+ */
+static
+int
+tlb_victim(void)
+{
+	int i;
 
-// return number of unused page start from strat_idx (exluded start_idx) 
-static int count_unused(int start_idx){
-	int count = 0;
-	int valid_page_num = (coremap_lastaddr - coremap_firstaddr) / PAGE_SIZE;
-	for (int i = start_idx + 1; i <  valid_page_num; i++) {
-		if (coremap[i] == 0) {
-			count += 1;
-		} else {
-			return count;
+#if TLBPOLICY == TLBPOLICY_RANDOM
+	(void)i;
+	vmstats_inc(VMSTAT_TLB_REPLACE_RANDOM);
+	return -1;
+#elif TLBPOLICY == TLBPOLICY_ROUNDROBIN
+	i = curcpu->c_tlbhand;
+	curcpu->c_tlbhand = (i + 1) % NUM_TLB;
+	vmstats_inc(VMSTAT_TLB_REPLACE_ROUNDROBIN);
+	return i;
+#else
+	// clock: at most one full sweep clearing use bits
+	for (;;) {
+		i = curcpu->c_tlbhand;
+		curcpu->c_tlbhand = (i + 1) % NUM_TLB;
+		if ((curcpu->c_tlbref & ((uint64_t)1 << i)) == 0) {
+			break;
 		}
+		tlb_setref(i, false);
+		vmstats_inc(VMSTAT_TLB_SECOND_CHANCE);
 	}
-	return count;
+	vmstats_inc(VMSTAT_TLB_REPLACE_CLOCK);
+	return i;
+#endif
 }
+#endif
 
 
-static
-paddr_t
-coremap_stealmem(unsigned long npages)
-{
-	// calculate number of pages needs for coremap
-  	int valid_page_num = (coremap_lastaddr - coremap_firstaddr) / PAGE_SIZE;
-
-	// loop through the coremap 
-	for (int i = 0; i < valid_page_num; i++) {
-    	int curr = coremap[i];
-		unsigned long count = 0;
-
-		if (curr == 0) { // current page is unused
-			count +=  1;
-			count += count_unused(i);
-			if (count >= npages) {
-				write_to_coremap(npages, i);
-				paddr_t size = (i + 1) * PAGE_SIZE;
-				return (coremap_firstaddr + size);
-			} else { // current page is used
-				continue;
-			}
-		}
-  }
-  return 0;
-}
-#endif
+void
+vm_bootstrap(void)
+{
+#if OPT_A3 // Managing Memory
 
+	// hand the remaining physical memory over to the page allocator
+	coremap_bootstrap();
+	
+	// update bool 
+	bootstrap = true;
 
+	// the refill fast path loads page table entries straight
+	// into EntryLo
+	COMPILE_ASSERT(PTE_TLBVALID == TLBLO_VALID);
+	COMPILE_ASSERT(PTE_TLBDIRTY == TLBLO_DIRTY);
 
+	// TLB shootdown: as_cpumask has a bit per cpu
+	COMPILE_ASSERT(MAXCPUS <= 32);
+
+	// paging: these need kmalloc
+	coremap_pin_bootstrap();
+	swap_bootstrap();
+	pagecache_bootstrap();
+	coremap_zero_bootstrap();
+
+	vmstats_init();
+#endif
+}
 
 
 static
@@ -152,10 +192,26 @@ getppages(unsigned long npages)
 
 #if OPT_A3 // Managing Memory 
     paddr_t addr;
+	unsigned long tries;
 	if (bootstrap) { // alloactes memory with providing coremap to release pages
-   		spinlock_acquire(&coremap_stealmem_lock);
-      	addr = coremap_stealmem(npages);
-    	spinlock_release(&coremap_stealmem_lock);		
+		addr = coremap_alloc(npages);
+
+		// out of frames: first drop the file pages nobody has mapped,
+		// which are mostly clean and cost nothing to give back
+		if (addr == 0 && pagecache_reclaim() > 0) {
+			addr = coremap_alloc(npages);
+		}
+
+		// paging: still out of frames, so push user pages out to swap until
+		// there is room. The clock frees neighbouring frames in turn,
+		// but kernel pages in between can stop them from merging, so
+		// multi-page requests give up eventually.
+		for (tries = 0; addr == 0 && tries < 32 * npages; tries++) {
+			if (swap_evict()) {
+				break;
+			}
+			addr = coremap_alloc(npages);
+		}
 	} else { // alloactes memory without providing any mechanism to release pages
 		spinlock_acquire(&stealmem_lock);
       	addr = ram_stealmem(npages); 
@@ -194,31 +250,187 @@ free_kpages(vaddr_t addr)
 {
 
 #if OPT_A3 // Managing Memory 
-	paddr_t p_addr = KVADDR_TO_PADDR(addr);
+	// frames stolen before vm_bootstrap are ignored (leaked)
+	if (bootstrap) {
+		coremap_free(KVADDR_TO_PADDR(addr));
+	}
+#else
+	/* nothing - leak the memory. */
+	(void)addr;
+#endif
+}
 
-	int valid_page_num = (coremap_lastaddr - coremap_firstaddr) / PAGE_SIZE;
-	
-	int count = (p_addr - coremap_firstaddr) / PAGE_SIZE;
+unsigned
+vm_reclaim(void)
+{
+	unsigned n = 0;
 
-	spinlock_acquire(&coremap_stealmem_lock);
+	// zombie threads still hold their kernel stacks
+	thread_reap();
+	// and objects cached for reuse hold kmalloc memory
+	kmem_reap();
+#if OPT_A3 // Managing Memory
+	if (bootstrap) {
+		n += pagecache_reclaim();
+		n += coremap_reclaim();
+	}
+#endif
+	return n;
+}
 
-	for (int i = count - 1; i < valid_page_num; i++) {
-		int curr = coremap[i];
-		if ((i == count - 1) || (curr > 1)) {
-			coremap[i] = 0; // free
-		} else { // curr == 0
-			break;
-		}
+
+#if OPT_A3 // copy-on-write
+/*
+ * Break copy-on-write sharing of the frame in *PTE before a write:
+ * if anyone else still maps it, give this page table entry a private
+ * copy and drop its reference to the shared frame. The frame in *PTE
+ * is pinned on entry and on return (paging), even if it changed.
+ */
+static int as_unshare_page(struct addrspace *as, vaddr_t vaddr,
+			   paddr_t *pte) {
+	paddr_t old = PTE_FRAME(*pte);
+	paddr_t new;
+
+	if (!coremap_is_shared(old)) {
+		return 0;
 	}
 
-  	spinlock_release(&coremap_stealmem_lock);
-#else
-	/* nothing - leak the memory. */
-	(void)addr;
+	new = getppages(1);
+	if (new == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(new),
+		(const void *)PADDR_TO_KVADDR(old), PAGE_SIZE);
+	*pte = (*pte & PTE_PERMS) | new;
+
+	// last one out frees it, whoever that turns out to be
+	free_kpages(PADDR_TO_KVADDR(old));
+
+	// paging: the copy is ours alone, so it has an owner now
+	coremap_pin(pte, as, vaddr);
+	return 0;
+}
 #endif
+
+
+#if OPT_A3 // paging
+void
+vm_tlbshootdown_all(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int i, spl;
+
+	spl = splhigh();
+	// ASIDs: entries of any address space may be here, not just the
+	// running one's. If the ASID is stale, so are its entries.
+	if (ts->ts_addrspace->as_asidgen != 0) {
+		i = tlb_probe(ts->ts_vaddr |
+			      ts->ts_addrspace->as_asid << TLBHI_PIDSHIFT, 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	splx(spl);
+}
+
+void
+vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	vm_tlbinvalidate_range(as, vaddr, vaddr + PAGE_SIZE);
+}
 
+void
+vm_tlbinvalidate_range(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	uint32_t mask, me;
+	unsigned i, npages;
+	vaddr_t va;
+	bool pending;
+	int spl, n;
+
+	KASSERT(start < end);
+	npages = (end - start) / PAGE_SIZE;
+
+	// more than a cpu takes at once: cheaper to retire the ASID
+	if (npages > TLBSHOOTDOWN_MAX) {
+		as_invalidate(as);
+		return;
+	}
+
+	// TLB shootdown: only the cpus that have run AS since it got its
+	// ASID can have entries for it. One that runs it from now on
+	// loads them from the page table, which is already up to date.
+	spinlock_acquire(&asid_lock);
+	mask = as->as_asidgen != 0 ? as->as_cpumask : 0;
+	spinlock_release(&asid_lock);
+	if (mask == 0) {
+		return;
+	}
+
+	ts.ts_addrspace = as;
+
+	// stay on this cpu until every other one has been sent the lot
+	spl = splhigh();
+	me = (uint32_t)1 << curcpu->c_number;
+	if (mask & me) {
+		for (va = start; va < end; va += PAGE_SIZE) {
+			ts.ts_vaddr = va;
+			vm_tlbshootdown(&ts);
+		}
+		mask &= ~me;
+	}
+	for (i = 0; i < cpu_numcpus(); i++) {
+		if (mask & ((uint32_t)1 << i)) {
+			c = cpu_getbynumber(i);
+
+			// if it still has others queued and ours won't fit,
+			// just have it flush everything (ipi_tlbshootdown
+			// does that too if this peek turns out to be stale)
+			spinlock_acquire(&c->c_ipi_lock);
+			n = c->c_numshootdown;
+			spinlock_release(&c->c_ipi_lock);
+			if (n == TLBSHOOTDOWN_ALL ||
+			    (unsigned)n + npages > TLBSHOOTDOWN_MAX) {
+				ipi_tlbshootdown_all(c);
+				continue;
+			}
+
+			for (va = start; va < end; va += PAGE_SIZE) {
+				ts.ts_vaddr = va;
+				ipi_tlbshootdown(c, &ts);
+			}
+		}
+	}
+	splx(spl);
+
+	// wait with interrupts on, or two cpus doing this to each other
+	// would never see each other's IPI
+	for (i = 0; i < cpu_numcpus(); i++) {
+		if ((mask & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		c = cpu_getbynumber(i);
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			pending = c->c_numshootdown != 0;
+			spinlock_release(&c->c_ipi_lock);
+		} while (pending);
+	}
+}
+#else
 void
 vm_tlbshootdown_all(void)
 {
@@ -231,11 +443,262 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	(void)ts;
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
+#endif
+
+static
+void
+as_zero_region(paddr_t paddr, unsigned npages)
+{
+	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+}
+
+#if OPT_A3 // page tables
+// the region VADDR is in, or NULL
+static struct region *as_find_region(struct addrspace *as, vaddr_t vaddr) {
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+#endif
+
+#if OPT_A3 // mmap
+// offset in the mapped file of the page at VADDR of the region RG
+static off_t as_mapoffset(struct region *rg, vaddr_t vaddr) {
+	return rg->rg_mapoff + ((vaddr & PAGE_FRAME) - rg->rg_vbase);
+}
+#endif
+
+#if OPT_A3 // shared text
+/*
+ * If the page at VADDR of region RG, whose entry is PTE, is a
+ * read-only page that is one whole page of the executable, return
+ * true and its offset in the file in *OFFSET. Every process running
+ * the executable can then map the same frame from the page cache.
+ */
+static
+bool
+as_textoffset(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	      paddr_t pte, off_t *offset)
+{
+	vaddr &= PAGE_FRAME;
+
+	if (as->as_vnode == NULL || rg->rg_writeable || (pte & PTE_WRITE)) {
+		return false;
+	}
+	if (vaddr < rg->rg_filevaddr ||
+	    vaddr + PAGE_SIZE > rg->rg_filevaddr + rg->rg_filesize) {
+		// not all of it is in the file (bss, or the end of the
+		// segment, where the rest of the page has to be zero)
+		return false;
+	}
+	*offset = rg->rg_fileoff + (vaddr - rg->rg_filevaddr);
+	return *offset % PAGE_SIZE == 0;
+}
+#endif
+
+#if OPT_A3 // growable stack
+/*
+ * Extend the stack region down to the page holding VADDR, if that is
+ * below the stack but within USERSTACK_MAXSIZE of its top and no other
+ * region is in the way. The new pages are filled in on first touch
+ * like any other. Returns EFAULT if VADDR can't be made part of the
+ * stack.
+ */
+static
+int
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack = as->as_stack;
+	struct region *rg;
+	vaddr_t base;
+	paddr_t *pte;
+
+	if (stack == NULL || vaddr >= stack->rg_vbase ||
+	    vaddr < USERSTACK - USERSTACK_MAXSIZE) {
+		return EFAULT;
+	}
+	base = vaddr & PAGE_FRAME;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg != stack &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base &&
+		    rg->rg_vbase < stack->rg_vbase) {
+			return EFAULT;
+		}
+	}
+
+	while (stack->rg_vbase > base) {
+		pte = pt_lookup(as->as_pt, stack->rg_vbase - PAGE_SIZE, true);
+		if (pte == NULL) {
+			return ENOMEM;
+		}
+		*pte |= PTE_VALID | PTE_WRITE;
+		stack->rg_vbase -= PAGE_SIZE;
+		stack->rg_npages++;
+	}
+	return 0;
+}
+#endif
+
+#if OPT_A3 // demand paging
+// true if any of the page at VADDR comes from the file behind RG
+static bool as_page_in_file(struct region *rg, vaddr_t vaddr) {
+	return rg->rg_filesize > 0 &&
+		vaddr < rg->rg_filevaddr + rg->rg_filesize &&
+		vaddr + PAGE_SIZE > rg->rg_filevaddr;
+}
+
+/*
+ * Fill the freshly allocated frame PADDR for the user page at VADDR.
+ * The part of the page that overlaps the file-backed part of its
+ * region RG is read in from the executable; the rest is zeroed.
+ */
+static
+int
+as_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	     struct region *rg)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	vaddr_t filevaddr = rg->rg_filevaddr;
+	off_t fileoff = rg->rg_fileoff;
+	size_t filesize = rg->rg_filesize;
+	int result;
+
+	start = vaddr > filevaddr ? vaddr : filevaddr;
+	end = vaddr + PAGE_SIZE < filevaddr + filesize ?
+		vaddr + PAGE_SIZE : filevaddr + filesize;
+
+	if (start >= end) {
+		// nothing of this page is in the file (bss, stack)
+		as_zero_region(paddr, 1);
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		return 0;
+	}
+
+	if (start != vaddr || end != vaddr + PAGE_SIZE) {
+		as_zero_region(paddr, 1);
+	}
+
+	KASSERT(as->as_vnode != NULL);
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + (start - vaddr)),
+		  end - start, fileoff + (start - filevaddr), UIO_READ);
+	result = VOP_READ(as->as_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+	return 0;
+}
+#endif
+
+#if OPT_A3 // fault-around
+int
+vm_setfaultaround(unsigned npages)
+{
+	if (npages > VM_FAULTAROUND_MAX || (npages & (npages - 1)) != 0) {
+		return EINVAL;
+	}
+	vm_faultaround = npages;
+	return 0;
+}
+
+/*
+ * Preload TLB entries for the resident pages of AS around the missed
+ * page FAULTADDRESS (with its ASID in the low bits): those in the
+ * aligned window of vm_faultaround pages that are in the same region
+ * and have been through vm_fault before, with the permissions it gave
+ * them. Preloaded entries go into free slots first, and are the first
+ * to go under the clock policy. Interrupts must be off.
+ */
+static
+void
+as_faultaround(struct addrspace *as, vaddr_t faultaddress)
+{
+	struct region *rg;
+	vaddr_t page, start, end, va;
+	paddr_t *pte;
+	paddr_t entry;
+	uint32_t asid, ehi, elo;
+	int i;
+
+	page = faultaddress & TLBHI_VPAGE;
+	asid = faultaddress & TLBHI_PID;
+
+	rg = as_find_region(as, page);
+	if (rg == NULL) {
+		return;
+	}
+	start = page & ~(vaddr_t)(vm_faultaround * PAGE_SIZE - 1);
+	end = start + vm_faultaround * PAGE_SIZE;
+	if (start < rg->rg_vbase) {
+		start = rg->rg_vbase;
+	}
+	if (end > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	}
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		if (va == page) {
+			continue;
+		}
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		// two entries for one page would be fatal
+		if (tlb_probe(va | asid, 0) >= 0) {
+			continue;
+		}
+		entry = coremap_prefetch(pte);
+		if (entry == 0) {
+			continue;
+		}
+
+		for (i = 0; i < NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) == 0) {
+				break;
+			}
+		}
+		ehi = va | asid;
+		elo = PTE_FRAME(entry) | TLBLO_VALID | (entry & PTE_TLBDIRTY);
+		if (i == NUM_TLB) {
+			vmstats_inc(VMSTAT_TLB_FAULTAROUND_REPLACE);
+			i = tlb_victim();
+		}
+		if (i < 0) {
+			tlb_random(ehi, elo);
+		}
+		else {
+			tlb_write(ehi, elo, i);
+			tlb_setref(i, false);
+		}
+		vmstats_inc(VMSTAT_TLB_FAULTAROUND);
+	}
+}
+#endif
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
+#if !OPT_A3 // page tables
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+#endif
 	paddr_t paddr;
 	int i;
 	uint32_t ehi, elo;
@@ -249,9 +712,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
 		/* We always create pages read-write, so we can't get this */
-#if OPT_A3 // read-only text seg
-		return EFAULT;
-		//kill_curthread()
+#if OPT_A3 // copy-on-write
+		/*
+		 * ...except that shared copy-on-write pages and the
+		 * text segment are mapped read-only. Sorted out below.
+		 */
+		break;
 #else
 		panic("dumbvm: got VM_FAULT_READONLY\n");
 #endif
@@ -279,19 +745,165 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 */
 		return EFAULT;
 	}
-
-	/* Assert that the address space has been set up properly. */
-#if OPT_A3 // Page Tables
-	KASSERT(as->as_vbase1 != 0);
-	//KASSERT(as->as_pbase1 != NULL); 
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	//KASSERT(as->as_pbase2 != NULL);
-	KASSERT(as->as_npages2 != 0);
-	//KASSERT(as->as_stackpbase != NULL); 
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
+
+#if OPT_A3 // page tables
+	paddr_t *pte;
+	paddr_t entry, newpaddr;
+	struct region *rg;
+	struct vnode *v;
+	off_t offset;
+	unsigned readstat;
+	bool writable, pagedin, readin;
+	int result;
+
+	/* Assert that the address space has been set up properly. */
+	KASSERT(as->as_pt != NULL);
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	// two-level walk; no table or an invalid entry means the address
+	// is in no region
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	if (pte == NULL || (*pte & PTE_VALID) == 0) {
+		// growable stack: unless it is just below the stack
+		result = as_grow_stack(as, faultaddress);
+		if (result) {
+			return result;
+		}
+		pte = pt_lookup(as->as_pt, faultaddress, false);
+		KASSERT(pte != NULL && (*pte & PTE_VALID) != 0);
+	}
+
+	// Read-only Text Seg: read-only pages only become so once
+	// load_elf is done with them
+	writable = (*pte & PTE_WRITE) != 0 || !as->as_loadelf_complete;
+	if (faulttype == VM_FAULT_READONLY && !writable) {
+		// a real write to a read-only page
+		return EFAULT;
+	}
+
+	// paging: from here until it is in the TLB, the frame is pinned
+	// so that it can't be evicted under us
+	entry = coremap_pin(pte, as, faultaddress);
+	pagedin = !PTE_ISRESIDENT(entry);
+
+	// fault-around: the entry preloaded for this page is gone without
+	// having saved a fault
+	if ((entry & PTE_PREFETCH) && faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_FAULTAROUND_REFAULT);
+	}
+
+	if (pagedin) {
+		rg = NULL;
+		if (!PTE_ISSWAPPED(entry)) {
+			rg = as_find_region(as, faultaddress);
+			KASSERT(rg != NULL);
+		}
+
+		// mmap and shared text: map the page cache's own frame
+		v = NULL;
+		if (rg != NULL && rg->rg_vnode != NULL) {
+			v = rg->rg_vnode;
+			offset = as_mapoffset(rg, faultaddress);
+			readstat = VMSTAT_MMAP_FILE_READ;
+		}
+		else if (rg != NULL &&
+			 as_textoffset(as, rg, faultaddress, entry, &offset)) {
+			v = as->as_vnode;
+			readstat = VMSTAT_ELF_FILE_READ;
+		}
+
+		if (v != NULL) {
+			result = pagecache_get(v, offset, &newpaddr, &readin);
+			if (result) {
+				return result;
+			}
+			if (readin) {
+				vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+				vmstats_inc(readstat);
+			}
+			else {
+				// another process already brought it in
+				vmstats_inc(VMSTAT_TLB_RELOAD);
+				curproc->p_vmstat.vms_reloads++;
+			}
+		}
+		else if (rg != NULL && !as_page_in_file(rg, faultaddress) &&
+			 (newpaddr = coremap_alloc_zeroed()) != 0) {
+			// zero-fill: the pagezero thread already cleared it
+			vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		}
+		else {
+			// demand paging: first touch or swapped out, so get
+			// a frame and fill it from the executable or from swap
+			newpaddr = getppages(1);
+			if (newpaddr == 0) {
+				return ENOMEM;
+			}
+			if (rg == NULL) {
+				result = swap_pagein(entry, newpaddr);
+				if (result == 0) {
+					curproc->p_vmstat.vms_swapins++;
+				}
+			}
+			else {
+				result = as_fill_page(as, faultaddress, newpaddr, rg);
+			}
+			if (result) {
+				free_kpages(PADDR_TO_KVADDR(newpaddr));
+				return result;
+			}
+		}
+		*pte = (*pte & PTE_PERMS) | newpaddr;
+		entry = coremap_pin(pte, as, faultaddress);
+		KASSERT(PTE_FRAME(entry) == newpaddr);
+	}
+	else if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		curproc->p_vmstat.vms_reloads++;
+	}
+
+	// copy-on-write: a write gets a private frame, a read of a
+	// shared frame gets a read-only mapping
+	if (writable) {
+		if (*pte & PTE_SHARED) {
+			// mmap: writes go to the cached page itself, which
+			// only a write fault makes dirty
+			if (faulttype == VM_FAULT_READ) {
+				writable = false;
+			}
+			else {
+				rg = as_find_region(as, faultaddress);
+				KASSERT(rg != NULL && rg->rg_vnode != NULL);
+				pagecache_dirty(rg->rg_vnode,
+						as_mapoffset(rg, faultaddress));
+			}
+		}
+		else if (faulttype == VM_FAULT_READ) {
+			writable = !coremap_is_shared(PTE_FRAME(*pte));
+		}
+		else {
+			result = as_unshare_page(as, faultaddress, pte);
+			if (result) {
+				coremap_unpin(PTE_FRAME(*pte));
+				return result;
+			}
+		}
+	}
+	paddr = PTE_FRAME(*pte);
+
+	// TLB refill fast path: from now on exception-mips1.S can load
+	// this page by itself, with the same permissions, unless load_elf
+	// is still writing to it. Shared frames are only loaded read-only
+	// (writable is false for them unless they are PTE_SHARED).
+	*pte &= ~PTE_TLBBITS;
+	if (as->as_loadelf_complete) {
+		*pte |= PTE_TLBVALID | (writable ? PTE_TLBDIRTY : 0);
+	}
 #else
+	/* Assert that the address space has been set up properly. */
 	KASSERT(as->as_vbase1 != 0);
 	KASSERT(as->as_pbase1 != 0);
 	KASSERT(as->as_npages1 != 0);
@@ -304,7 +916,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-#endif
 
 	vbase1 = as->as_vbase1;
 	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
@@ -313,32 +924,19 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
 	stacktop = USERSTACK;
 
-#if OPT_A3 // Read-only Text Seg
-	bool text_segment = false;
-#endif
-
-	// Page Tables
 	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1[0];
-				text_segment = true;
-	
-#if OPT_A3 // Read-only Text Seg
-		text_segment = true;
-#endif
-
+		paddr = (faultaddress - vbase1) + as->as_pbase1;
 	}
 	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2[0]; 
+		paddr = (faultaddress - vbase2) + as->as_pbase2;
 	}
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase[0];
+		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
-
-	
 	else {
 		return EFAULT;
 	}
-
+#endif
 
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
@@ -346,6 +944,43 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+#if OPT_A3 // ASIDs
+	// as_activate has made our ASID the current one
+	KASSERT(as->as_asidgen != 0);
+	faultaddress |= as->as_asid << TLBHI_PIDSHIFT;
+#endif
+
+#if OPT_A3 // copy-on-write
+	if (faulttype == VM_FAULT_READONLY) {
+		// upgrade the read-only entry that is already in the TLB
+		i = tlb_probe(faultaddress, 0);
+		if (i >= 0) {
+			tlb_write(faultaddress, paddr | TLBLO_DIRTY | TLBLO_VALID, i);
+			// TLB replacement: a page being written is in use
+			tlb_setref(i, true);
+			splx(spl);
+			coremap_unpin(paddr);
+			return 0;
+		}
+		// it was flushed in the meantime; load it like a miss
+		if (!pagedin) {
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+			curproc->p_vmstat.vms_reloads++;
+		}
+	}
+#endif
+
+#if OPT_A3 // demand paging
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	curproc->p_vmstat.vms_faults++;
+#endif
+
+#if OPT_A3 // fault-around
+	if (vm_faultaround > 1 && as->as_loadelf_complete) {
+		as_faultaround(as, faultaddress);
+	}
+#endif
+
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_read(&ehi, &elo, i);
 		if (elo & TLBLO_VALID) {
@@ -354,27 +989,43 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		ehi = faultaddress;
 		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-#if OPT_A3 // Read-only Text Seg
-		if (as->as_loadelf_complete && text_segment) {
+#if OPT_A3 // Read-only Text Seg, copy-on-write
+		if (!writable) {
 			elo &= ~TLBLO_DIRTY;
 		}
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		// TLB replacement: a page that is back after being
+		// dropped from the TLB has been in use before
+		tlb_setref(i, !pagedin);
 #endif
 		tlb_write(ehi, elo, i);
 		splx(spl);
+#if OPT_A3 // paging
+		coremap_unpin(paddr);
+#endif
 		return 0;
 	}
 
 #if OPT_A3 //TLB Replacement//
-	// TLB is full, call tlb_random to write entry into a random TLB slot
+	// TLB is full, replace an entry as TLBPOLICY says
 	ehi = faultaddress;
 	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
 
-	if (as->as_loadelf_complete && text_segment) { // Read-only Text Seg
+	if (!writable) { // Read-only Text Seg, copy-on-write
 		elo &= ~TLBLO_DIRTY;
 	}
 
-	tlb_random(ehi, elo);
+	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	i = tlb_victim();
+	if (i < 0) {
+		tlb_random(ehi, elo);
+	}
+	else {
+		tlb_write(ehi, elo, i);
+		tlb_setref(i, !pagedin);
+	}
 	splx(spl);
+	coremap_unpin(paddr);
 	return 0;
 #else 
 
@@ -393,13 +1044,12 @@ as_create(void)
 	}
 
 #if OPT_A3 // Page Tables
-	as->as_vbase1 = 0;
-	as->as_pbase1 = NULL;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	as->as_pbase2 = NULL;
-	as->as_npages2 = 0;
-	as->as_stackpbase = NULL;
+	as->as_regions = NULL;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
 #else
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
@@ -414,6 +1064,25 @@ as_create(void)
 	as->as_loadelf_complete = false;
 # endif
 
+#if OPT_A3 // demand paging
+	as->as_vnode = NULL;
+#endif
+
+#if OPT_A3 // ASIDs
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_cpumask = 0;
+#endif
+
+#if OPT_A3 // growable stack
+	as->as_stack = NULL;
+#endif
+
+#if OPT_A3 // sbrk
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+#endif
+
 	return as;
 }
 
@@ -422,24 +1091,28 @@ as_destroy(struct addrspace *as)
 {
 
 #if OPT_A3 // Page Tables
+	struct region *rg;
+
+	// free the frames and swap slots of every page, and the table
+	pt_destroy(as->as_pt);
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_vnode != NULL) {
+			// mmap: an implicit munmap
+			if (rg->rg_shared) {
+				pagecache_flush(rg->rg_vnode);
+			}
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
 
-	// call free_kpages on the frames for each segment
-	int np1 = (int) as->as_npages1;
-	int np2 = (int) as->as_npages2;
-	for (int i = 0; i < np1; i++) {
-		vaddr_t addr = PADDR_TO_KVADDR(as->as_pbase1[i]);
-		free_kpages(addr);
-	}
-  	for (int i = 0; i < np2; i++) {
-		vaddr_t addr = PADDR_TO_KVADDR(as->as_pbase2[i]);
-		free_kpages(addr);
-  	}
-	
-	// kfree the page tables
-  	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-		vaddr_t addr = PADDR_TO_KVADDR(as->as_stackpbase[i]);
-		free_kpages(addr);
-  	}
+	// demand paging: drop our hold on the executable
+	if (as->as_vnode != NULL) {
+		vfs_close(as->as_vnode);
+	}
 
 	kfree(as);
 #else
@@ -458,23 +1131,81 @@ as_activate(void)
         /* Kernel threads don't have an address spaces to activate */
 #endif
 	if (as == NULL) {
+#if OPT_A3 // TLB refill fast path
+		cpupagetables[curcpu->c_number] = 0;
+#endif
 		return;
 	}
 
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+#if OPT_A3 // TLB refill fast path
+	cpupagetables[curcpu->c_number] = (vaddr_t)as->as_pt;
+#endif
+
+#if OPT_A3 // ASIDs
+	spinlock_acquire(&asid_lock);
+
+	if (as->as_asidgen != asid_generation) {
+		if (asid_next == NUM_ASID) {
+			asid_generation++;
+			asid_next = 1;
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_generation;
+		// TLB shootdown: nobody has entries with the new ASID yet
+		as->as_cpumask = 0;
+	}
+
+	// entries left over from an older generation may now belong to
+	// someone else's ASID; otherwise the TLB can stay as it is
+	if (curcpu->c_tlbgen != asid_generation) {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		curcpu->c_tlbgen = asid_generation;
+		vmstats_inc(VMSTAT_TLB_INVALIDATE);
+	}
+
+	tlb_setasid(as->as_asid);
+	as->as_cpumask |= (uint32_t)1 << curcpu->c_number;
+
+	spinlock_release(&asid_lock);
+#else
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+#endif
 
 	splx(spl);
 }
 
+#if OPT_A3 // ASIDs
+void
+as_invalidate(struct addrspace *as)
+{
+	// the entries with the old ASID can't match anything any more,
+	// and it won't be handed out again before every TLB is flushed
+	spinlock_acquire(&asid_lock);
+	as->as_asidgen = 0;
+	spinlock_release(&asid_lock);
+
+	if (as == curproc_getas()) {
+		as_activate();
+	}
+}
+#endif
+
 void
 as_deactivate(void)
 {
+#if OPT_A3 // TLB refill fast path
+	// the address space may be about to go away
+	cpupagetables[curcpu->c_number] = 0;
+#else
 	/* nothing */
+#endif
 }
 
 int
@@ -492,6 +1223,50 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
+#if OPT_A3 // Page Tables
+	struct region *rg;
+	paddr_t *pte;
+	size_t i;
+
+	// we don't do anything with readable/executable; MIPS can't
+	// enforce them
+	(void)readable;
+	(void)executable;
+
+	if (vaddr + sz < vaddr || vaddr + sz > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_writeable = writeable != 0;
+	rg->rg_filevaddr = 0;
+	rg->rg_fileoff = 0;
+	rg->rg_filesize = 0;
+	rg->rg_mmapped = false;
+	rg->rg_shared = false;
+	rg->rg_vnode = NULL;
+	rg->rg_mapoff = 0;
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+
+	// mark the pages as part of the address space; frames come later,
+	// on first touch (a page shared with a neighbouring segment ends
+	// up writable if either one is)
+	for (i = 0; i < npages; i++) {
+		pte = pt_lookup(as->as_pt, vaddr + i * PAGE_SIZE, true);
+		if (pte == NULL) {
+			return ENOMEM;
+		}
+		*pte |= PTE_VALID | (writeable ? PTE_WRITE : 0);
+	}
+
+	return 0;
+#else
 	/* We don't use these - all pages are read-write */
 	(void)readable;
 	(void)writeable;
@@ -500,25 +1275,12 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
-
-#if OPT_A3 // Page Tables
-		as->as_pbase1 = kmalloc( sizeof(paddr_t) * npages);
-#endif
-
 		return 0;
 	}
 
 	if (as->as_vbase2 == 0) {
 		as->as_vbase2 = vaddr;
 		as->as_npages2 = npages;
-
-#if OPT_A3 // Page Tables
-	   as->as_pbase2 = kmalloc(sizeof(paddr_t) * npages);
-
-	   if (as->as_pbase2 == NULL) {
-		   panic("cannot use alloc mem");
-	   }
-#endif
 		return 0;
 	}
 
@@ -527,13 +1289,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	 */
 	kprintf("dumbvm: Warning: too many regions\n");
 	return EUNIMP;
-}
-
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+#endif
 }
 
 int
@@ -542,41 +1298,9 @@ as_prepare_load(struct addrspace *as)
 	
 #if OPT_A3 // Page Tables
 
-	// pre-allocate frames for each page in the segment 
-	// allocate each frame one at a time
-	int np1 = (int) as->as_npages1;
-	int np2 = (int) as->as_npages2;
-	unsigned long one = 1;
-
-	for (int i = 0; i < np1; i++) {
-    	as->as_pbase1[i] = getppages(one); 
-    	if (as->as_pbase1[i] == 0) { // error check
-			return ENOMEM;
-		}
-		as_zero_region(as->as_pbase1[i], 1);
-  	}
-	for (int i = 0; i < np2; i++) {
-    	as->as_pbase2[i] = getppages(one);
-		if (as->as_pbase2[i] == 0) { // error check
-			return ENOMEM;
-		}
-    	as_zero_region(as->as_pbase2[i], one);
-  	}
-
-	// create a page table for the stack
-	as->as_stackpbase = kmalloc(sizeof(paddr_t) * DUMBVM_STACKPAGES);
-	if (as->as_stackpbase == NULL) { // error check
-		return ENOMEM;
-	}
-
-  	for (unsigned int i = 0; i < DUMBVM_STACKPAGES; i++) {
-    	as->as_stackpbase[i] = getppages(one);
-		if (as->as_stackpbase[i] == 0) { // error check
-			return ENOMEM;
-		}
-    	as_zero_region(as->as_stackpbase[i], 1);
-  	}
-  	
+	// demand paging: pages are read in or zero-filled by vm_fault on
+	// first touch, and as_define_region already set up the page table
+	(void)as;
 	return 0;
 #else
 	KASSERT(as->as_pbase1 == 0);
@@ -606,10 +1330,71 @@ as_prepare_load(struct addrspace *as)
 #endif
 }
 
+#if OPT_A3 // demand paging
+int
+as_define_backing(struct addrspace *as, struct vnode *v,
+		  off_t offset, vaddr_t vaddr,
+		  size_t memsize, size_t filesize)
+{
+	struct region *rg;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	// load_segment relied on uiomove to refuse kernel addresses;
+	// nothing is copied here, so check explicitly
+	if (vaddr + memsize < vaddr || vaddr + memsize > USERSPACETOP) {
+		return ENOEXEC;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx for demand paging\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	if (as->as_vnode == NULL) {
+		// keep the executable open until the address space goes away
+		VOP_INCOPEN(v);
+		VOP_INCREF(v);
+		as->as_vnode = v;
+	}
+	KASSERT(as->as_vnode == v);
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL) {
+		kprintf("dumbvm: segment at 0x%x was never defined\n", vaddr);
+		return ENOEXEC;
+	}
+	rg->rg_filevaddr = vaddr;
+	rg->rg_fileoff = offset;
+	rg->rg_filesize = filesize;
+	return 0;
+}
+#endif
+
 int
 as_complete_load(struct addrspace *as)
 {
+#if OPT_A3 // sbrk
+	struct region *rg;
+	vaddr_t end = 0;
+	int result;
+
+	// the heap starts out empty, on the page after the last segment
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE > end) {
+			end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+	}
+	result = as_define_region(as, end, 0, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	as->as_heap = as->as_regions;
+	as->as_heapend = end;
+#else
 	(void)as;
+#endif
 	return 0;
 }
 
@@ -617,8 +1402,16 @@ int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
 #if OPT_A3 // page table
-	//KASSERT(as->as_stackpbase != 0);
-	(void)as;
+	int result;
+
+	// the stack is just another region, one that starts small and
+	// grows (see as_grow_stack)
+	result = as_define_region(as, USERSTACK - USERSTACK_INITPAGES * PAGE_SIZE,
+				  USERSTACK_INITPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	as->as_stack = as->as_regions;
 #else
 	KASSERT(as->as_stackpbase != 0);
 #endif
@@ -627,6 +1420,212 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+#if OPT_A3 // sbrk, mmap
+/*
+ * Drop the pages in [START, END): free their frames or swap slots and
+ * take them out of the address space. The caller gets rid of their
+ * TLB entries.
+ */
+static
+void
+as_release_pages(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t va;
+	paddr_t *pte;
+	paddr_t entry;
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		// paging: waits for the page if it is being swapped out
+		entry = coremap_pin(pte, NULL, 0);
+		*pte = 0;
+		if (PTE_ISSWAPPED(entry)) {
+			swap_free(entry);
+		}
+		else if (PTE_ISRESIDENT(entry)) {
+			free_kpages(PADDR_TO_KVADDR(PTE_FRAME(entry)));
+		}
+	}
+}
+#endif
+
+#if OPT_A3 // sbrk
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldend)
+{
+	struct region *heap = as->as_heap;
+	struct region *rg;
+	vaddr_t end, top, newtop, va;
+	paddr_t *pte;
+
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	end = as->as_heapend + amount;
+	if (amount < 0 && (end > as->as_heapend || end < heap->rg_vbase)) {
+		return EINVAL;
+	}
+	if (amount > 0 && end < as->as_heapend) {
+		return ENOMEM;
+	}
+
+	top = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	newtop = ROUNDUP(end, PAGE_SIZE);
+
+	if (newtop > top) {
+		// keep clear of the room the stack may grow into, and of
+		// everything else
+		if (newtop > USERSTACK - USERSTACK_MAXSIZE) {
+			return ENOMEM;
+		}
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg != heap && rg->rg_vbase < newtop &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > top) {
+				return ENOMEM;
+			}
+		}
+
+		// frames come later, on first touch
+		for (va = top; va < newtop; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, true);
+			if (pte == NULL) {
+				as_release_pages(as, top, va);
+				return ENOMEM;
+			}
+			KASSERT(*pte == 0);
+			*pte = PTE_VALID | PTE_WRITE;
+		}
+	}
+	else if (newtop < top) {
+		// nothing of ours runs in user mode until we return, so the
+		// TLB entries can go after the frames
+		as_release_pages(as, newtop, top);
+		vm_tlbinvalidate_range(as, newtop, top);
+	}
+
+	heap->rg_npages = (newtop - heap->rg_vbase) / PAGE_SIZE;
+	*oldend = as->as_heapend;
+	as->as_heapend = end;
+	return 0;
+}
+#endif
+
+#if OPT_A3 // mmap
+int
+as_mmap(struct addrspace *as, struct vnode *v, off_t offset, size_t len,
+	int prot, int flags, vaddr_t *vaddr)
+{
+	struct region *rg;
+	vaddr_t base, top;
+	size_t size, i;
+	paddr_t *pte;
+	int result;
+
+	size = ROUNDUP(len, PAGE_SIZE);
+	if (len == 0 || size < len || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		// anonymous memory is never shared
+		if (v == NULL) {
+			return EINVAL;
+		}
+		break;
+	    case MAP_PRIVATE:
+		break;
+	    default:
+		return EINVAL;
+	}
+	if (flags & MAP_FIXED) {
+		return EINVAL;
+	}
+	if (v != NULL) {
+		result = VOP_MMAP(v);
+		if (result) {
+			return result;
+		}
+	}
+
+	// the highest gap below the room kept for the stack
+	top = USERSTACK - USERSTACK_MAXSIZE;
+	for (;;) {
+		if (top <= size) {
+			return ENOMEM;
+		}
+		base = top - size;
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg->rg_vbase < top &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base) {
+				break;
+			}
+		}
+		if (rg == NULL) {
+			break;
+		}
+		top = rg->rg_vbase;
+	}
+
+	result = as_define_region(as, base, size, 1, prot & PROT_WRITE, 0);
+	if (result) {
+		return result;
+	}
+	rg = as->as_regions;
+	rg->rg_mmapped = true;
+	if (v != NULL) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+		rg->rg_mapoff = offset;
+		rg->rg_shared = (flags & MAP_SHARED) != 0;
+	}
+	if (rg->rg_shared) {
+		for (i = 0; i < size; i += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, base + i, false);
+			KASSERT(pte != NULL);
+			*pte |= PTE_SHARED;
+		}
+	}
+
+	*vaddr = base;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region **rgp, *rg;
+	int result = 0;
+
+	for (rgp = &as->as_regions; *rgp != NULL; rgp = &(*rgp)->rg_next) {
+		if ((*rgp)->rg_mmapped && (*rgp)->rg_vbase == vaddr) {
+			break;
+		}
+	}
+	rg = *rgp;
+	if (rg == NULL || ROUNDUP(len, PAGE_SIZE) != rg->rg_npages * PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	as_release_pages(as, vaddr, vaddr + rg->rg_npages * PAGE_SIZE);
+	vm_tlbinvalidate_range(as, vaddr, vaddr + rg->rg_npages * PAGE_SIZE);
+
+	if (rg->rg_vnode != NULL) {
+		if (rg->rg_shared) {
+			result = pagecache_flush(rg->rg_vnode);
+		}
+		VOP_DECREF(rg->rg_vnode);
+	}
+	*rgp = rg->rg_next;
+	kfree(rg);
+
+	return result;
+}
+#endif
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -639,19 +1638,59 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
+#if OPT_A3 // Page Tables
+	struct region *rg, *newrg;
+	int result;
+
+	// create regions based on old address space
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		newrg = kmalloc(sizeof(struct region));
+		if (newrg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*newrg = *rg;
+		newrg->rg_next = new->as_regions;
+		new->as_regions = newrg;
+		if (rg == old->as_stack) {
+			new->as_stack = newrg;
+		}
+		if (rg == old->as_heap) {
+			new->as_heap = newrg;
+		}
+		if (newrg->rg_vnode != NULL) {
+			VOP_INCREF(newrg->rg_vnode);
+		}
+	}
+
+	new->as_heapend = old->as_heapend;
+
+	// pages the parent never touched stay on disk for the child too
+	new->as_loadelf_complete = old->as_loadelf_complete;
+	if (old->as_vnode != NULL) {
+		VOP_INCOPEN(old->as_vnode);
+		VOP_INCREF(old->as_vnode);
+		new->as_vnode = old->as_vnode;
+	}
+
+	// share the resident frames with the old address space; they
+	// are only copied when one side writes to them (see vm_fault)
+	result = pt_copy(new->as_pt, old->as_pt);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	// the parent's TLB may still hold writable entries for frames
+	// that are now shared; flush them so its next write faults
+	as_invalidate(old);
+#else
 	// create segments based on old address space
 	new->as_vbase1 = old->as_vbase1;
 	new->as_npages1 = old->as_npages1;
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
 
-#if OPT_A3 // Page Tables
-	// allocate frames for the segments
-  	new->as_pbase1 = kmalloc(sizeof(paddr_t) * old->as_npages1);
-  	new->as_pbase2 = kmalloc(sizeof(paddr_t) * old->as_npages2);
-  	new->as_stackpbase = kmalloc(sizeof(paddr_t) * DUMBVM_STACKPAGES);
-#endif
-
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
 	if (as_prepare_load(new)) {
 		as_destroy(new);
@@ -662,25 +1701,6 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	KASSERT(new->as_pbase2 != 0);
 	KASSERT(new->as_stackpbase != 0);
 
-#if OPT_A3 // Page Tables
-	// memcopy frames from the old address space to the frames new address space
-	int np1 = old->as_npages1;
-	int np2 =  old->as_npages2;
-
-  	for (int i = 0; i < np1; i++) {
-		memmove((void *)PADDR_TO_KVADDR(new->as_pbase1[i]),
-      	(const void *)PADDR_TO_KVADDR(old->as_pbase1[i]),PAGE_SIZE);
-  	}
-  	for (int i = 0; i < np2; i++) {
-    	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2[i]),
-      	(const void *)PADDR_TO_KVADDR(old->as_pbase2[i]),PAGE_SIZE);
-  	}
-  	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-    	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase[i]),
-
-      	(const void *)PADDR_TO_KVADDR(old->as_stackpbase[i]),PAGE_SIZE);
-  	}
-#else
 	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
 		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
 		old->as_npages1*PAGE_SIZE);
@@ -109,5 +109,10 @@ SRCS+=$(KTOP)/vfs/vfslist.c
 SRCS+=$(KTOP)/vfs/vfslookup.c
 SRCS+=$(KTOP)/vfs/vfspath.c
 SRCS+=$(KTOP)/vfs/vnode.c
+SRCS+=$(KTOP)/vm/coremap.c
 SRCS+=$(KTOP)/vm/kmalloc.c
+SRCS+=$(KTOP)/vm/kmem.c
+SRCS+=$(KTOP)/vm/pagecache.c
+SRCS+=$(KTOP)/vm/pagetable.c
+SRCS+=$(KTOP)/vm/swap.c
 SRCS+=$(KTOP)/vm/uw-vmstats.c
@@ -52,7 +52,9 @@
 #include <platform/bus.h>
 #include <vfs.h>
 #include <emufs.h>
+#include <pagecache.h>
 #include "autoconf.h"
+#include "opt-A3.h"
 
 /* Register offsets */
 #define REG_HANDLE    0
@@ -705,8 +707,12 @@ static
 int
 emufs_fsync(struct vnode *v)
 {
+#if OPT_A3
+	return pagecache_flush(v);
+#else
 	(void)v;
 	return 0;
+#endif
 }
 
 /*
@@ -842,8 +848,9 @@ static
 int
 emufs_mmap(struct vnode *v)
 {
+	/* the page cache uses emufs_read and emufs_write */
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 //////////////////////////////
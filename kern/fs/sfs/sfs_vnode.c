@@ -44,11 +44,21 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <pagecache.h>
+#include <kmem.h>
+#include "opt-A3.h"
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/*
+ * In-memory vnodes. They have no locks of their own (the vfs big lock
+ * covers them), so there is nothing for a constructor to keep set up.
+ */
+static struct kmem_cache sfs_vnode_cache =
+	KMEM_CACHE_INITIALIZER("sfs_vnode", struct sfs_vnode, NULL, NULL);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -953,7 +963,7 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(&sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -1102,6 +1112,14 @@ sfs_fsync(struct vnode *v)
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
+#if OPT_A3
+	/* mapped pages first; they are written with sfs_write */
+	result = pagecache_flush(v);
+	if (result) {
+		return result;
+	}
+#endif
+
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
 	vfs_biglock_release();
@@ -1110,14 +1128,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any file can be mapped; the page cache does the
+ * rest with sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
@@ -1685,7 +1704,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(&sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1699,7 +1718,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1736,7 +1755,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1747,7 +1766,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
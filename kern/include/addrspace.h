@@ -40,8 +40,33 @@
 #include "opt-A3.h"
 
 struct vnode;
+struct pagetable;
 
 
+#if OPT_A3 // page tables
+/*
+ * A region of an address space: an ELF segment or the stack.
+ */
+struct region {
+  vaddr_t rg_vbase;
+  size_t rg_npages;
+  bool rg_writeable;
+  // demand paging: [rg_filevaddr, +rg_filesize) is read from the
+  // executable at rg_fileoff, everything else is zero-filled
+  vaddr_t rg_filevaddr;
+  off_t rg_fileoff;
+  size_t rg_filesize;
+  // mmap: pages come from the page cache of rg_vnode, starting at
+  // rg_mapoff, or are zero-filled if it is NULL; rg_shared regions
+  // write through to the cache (their entries have PTE_SHARED)
+  bool rg_mmapped;
+  bool rg_shared;
+  struct vnode *rg_vnode;
+  off_t rg_mapoff;
+  struct region *rg_next;
+};
+#endif
+
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -52,13 +77,10 @@ struct vnode;
 struct addrspace {
 
 #if OPT_A3 // page tables
-  vaddr_t as_vbase1;
-  paddr_t* as_pbase1;
-  size_t as_npages1;
-  vaddr_t as_vbase2;
-  paddr_t* as_pbase2;
-  size_t as_npages2;
-  paddr_t* as_stackpbase;
+  // any number of regions; the page table is what vm_fault walks,
+  // the region list is only needed to fill a page on first touch
+  struct region *as_regions;
+  struct pagetable *as_pt;
 #else
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -73,6 +95,36 @@ struct addrspace {
   // flag that indicates whether or not load_elf has completed
   bool as_loadelf_complete;
 #endif
+
+#if OPT_A3 // ASIDs
+  // TLB entries of this address space carry as_asid; it is only
+  // valid while as_asidgen is the current ASID generation
+  uint32_t as_asid;
+  uint32_t as_asidgen;
+#endif
+
+#if OPT_A3 // TLB shootdown
+  // bit N set if cpu N has run us since we got as_asid, and so may
+  // hold entries for us (protected by the ASID lock)
+  uint32_t as_cpumask;
+#endif
+
+#if OPT_A3 // demand paging
+  // executable the segments are paged in from (held open while in use)
+  struct vnode *as_vnode;
+#endif
+
+#if OPT_A3 // growable stack
+  // the stack region, which vm_fault extends downwards
+  struct region *as_stack;
+#endif
+
+#if OPT_A3 // sbrk
+  // the heap region, set up right after the executable's segments,
+  // and the current break; the region ends at the break rounded up
+  struct region *as_heap;
+  vaddr_t as_heapend;
+#endif
 };
 
 /*
@@ -94,6 +146,9 @@ struct addrspace {
  *    as_deactivate - unload curproc's address space so it isn't
  *                currently "seen" by the processor.
  *
+ *    as_invalidate - drop every TLB entry of an address space, on
+ *                every processor.
+ *
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
  *
@@ -106,15 +161,35 @@ struct addrspace {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_define_backing - record where in the executable V the contents
+ *                of the segment at VADDR live, so its pages can be read
+ *                in on first touch instead of being loaded up front.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes and hand back
+ *                the old end. Pages are allocated on first touch and
+ *                freed when the heap shrinks past them.
+
+ *
+ *    as_mmap   - map LEN bytes of V from OFFSET (page-aligned), or
+ *                zero-filled memory if V is NULL, somewhere below the
+ *                stack, and hand back the address. PROT and FLAGS are
+ *                as for mmap (kern/mman.h).
+ *
+ *    as_munmap - remove the mapping made by as_mmap at VADDR, which
+ *                must be LEN bytes long, writing back shared pages.
  */
 
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
 void              as_deactivate(void);
+#if OPT_A3 // ASIDs
+void              as_invalidate(struct addrspace *as);
+#endif
 void              as_destroy(struct addrspace *);
 
 int               as_define_region(struct addrspace *as, 
@@ -124,7 +199,21 @@ int               as_define_region(struct addrspace *as,
                                    int executable);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
+#if OPT_A3 // demand paging
+int               as_define_backing(struct addrspace *as, struct vnode *v,
+                                    off_t offset, vaddr_t vaddr,
+                                    size_t memsize, size_t filesize);
+#endif
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3 // sbrk
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldend);
+#endif
+#if OPT_A3 // mmap
+int               as_mmap(struct addrspace *as, struct vnode *v, off_t offset,
+                          size_t len, int prot, int flags, vaddr_t *vaddr);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+#endif
 
 
 /*
@@ -50,6 +50,12 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyin_ptrarray copies a null-terminated array of at most MAX user
+ * pointers (such as an argv) from a user-space address USERSRC to a
+ * kernel-space address DEST, null included, and returns the number of
+ * pointers before the null in GOT. If there is no null among the
+ * first MAX, it returns E2BIG.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -68,6 +74,8 @@ int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
+int copyin_ptrarray(const_userptr_t usersrc, userptr_t *dest, size_t max,
+                    size_t *got);
 
 
 #endif /* _COPYINOUT_H_ */
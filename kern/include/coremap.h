@@ -0,0 +1,91 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * Every frame of RAM left over after boot is described by a coremap
+ * entry. Free frames are kept in a binary buddy system: one free list
+ * per block order (a block of order k is 2^k frames, aligned to 2^k),
+ * so allocating or freeing a single page never scans the coremap, and
+ * freed multi-page blocks are coalesced with their buddies. Single
+ * pages are additionally cached per cpu (see struct cpu).
+ *
+ * Functions:
+ *     coremap_bootstrap - take over the memory ram.c has not handed out.
+ *                         Called once from vm_bootstrap.
+ *     coremap_alloc     - allocate NPAGES physically contiguous frames.
+ *                         Returns 0 if there is no such run.
+ *     coremap_free      - drop a reference to the block starting at
+ *                         PADDR; the block is freed with the last one.
+ *                         Addresses stolen before bootstrap are ignored.
+ *     coremap_share     - add a reference to a single-page block that is
+ *                         about to be mapped a second time (copy-on-write).
+ *     coremap_is_shared - true if more than one reference to the frame
+ *                         at PADDR exists.
+ *     coremap_inuse     - the number of frames allocated right now,
+ *                         not counting free ones held in cpu caches
+ *                         or the zero pool.
+ *     coremap_printstats - print free page counts and the hit rates of
+ *                         each cpu's page cache and of the zero pool.
+ *
+ * Pre-zeroed pages:
+ *     coremap_zero_bootstrap - start the pagezero thread. Called once
+ *                         threads can be forked.
+ *     coremap_alloc_zeroed - allocate a single frame that is already
+ *                         zero. Returns 0 if none is ready; allocate
+ *                         and clear one as usual then.
+ *     coremap_idle      - called from the idle loop with interrupts
+ *                         off: wake the pagezero thread if the pool of
+ *                         zeroed frames is low.
+ *     coremap_reclaim   - give this cpu's cached pages and the zero pool
+ *                         back to the free lists, so that multi-page
+ *                         blocks can form again. Returns about how many
+ *                         frames that was.
+ *
+ * Paging (see swap.h):
+ *     coremap_pin_bootstrap - set up waiting for pinned pages. Called
+ *                         once kmalloc works.
+ *     coremap_pin       - return *PTE; if it is resident, pin the frame
+ *                         first, waiting out an eviction in progress,
+ *                         and make PTE (page VADDR of AS) its owner if
+ *                         AS is not NULL and the frame is not shared.
+ *                         Freeing a pinned frame also unpins it.
+ *     coremap_unpin     - let the evictor have the frame at PADDR again.
+ *     coremap_prefetch  - for fault-around: if the resident page in *PTE
+ *                         has been through vm_fault and is not being
+ *                         evicted, mark it PTE_PREFETCH and return the
+ *                         entry it had, otherwise 0. Interrupts must
+ *                         stay off until it is in the TLB.
+ *     coremap_victim    - pick an owned, unpinned frame with the clock
+ *                         algorithm, pin it, and report its owner.
+ *                         Returns 0 if there is none.
+ *     coremap_evicted   - replace the frame in the victim PADDR's page
+ *                         table entry with swap entry PTE, and free the
+ *                         frame.
+ */
+
+struct addrspace;
+
+void    coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+void    coremap_free(paddr_t paddr);
+void    coremap_share(paddr_t paddr);
+bool    coremap_is_shared(paddr_t paddr);
+unsigned coremap_inuse(void);
+void    coremap_printstats(void);
+
+void    coremap_zero_bootstrap(void);
+paddr_t coremap_alloc_zeroed(void);
+void    coremap_idle(void);
+unsigned coremap_reclaim(void);
+
+void    coremap_pin_bootstrap(void);
+paddr_t coremap_pin(paddr_t *pte, struct addrspace *as, vaddr_t vaddr);
+void    coremap_unpin(paddr_t paddr);
+paddr_t coremap_prefetch(paddr_t *pte);
+paddr_t coremap_victim(struct addrspace **as, vaddr_t *vaddr);
+void    coremap_evicted(paddr_t paddr, paddr_t pte);
+
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,17 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <uw-vmstats.h>  /* for VMSTAT_COUNT */
+
+#include "opt-A3.h"
+
+/* Run queue priority levels; 0 is the highest (see thread.c) */
+#define SCHED_NLEVELS 4
+
+#if OPT_A3 // per-cpu page cache
+/* Free pages each cpu keeps for itself (see vm/coremap.c) */
+#define CPU_FREEPAGES_MAX 16
+#endif
 
 
 /*
@@ -61,12 +72,61 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 
+#if OPT_A3 // per-cpu page cache
+	/*
+	 * Single free pages cached by this cpu so getppages(1) and
+	 * free_kpages don't need the coremap lock. Accessed only by
+	 * this cpu, with interrupts off.
+	 */
+	paddr_t c_freepages[CPU_FREEPAGES_MAX];
+	unsigned c_nfreepages;
+	unsigned c_freepage_hits;	/* allocs served from the cache */
+	unsigned c_freepage_misses;	/* allocs that had to refill it */
+	unsigned c_freepage_drains;	/* frees that overflowed it */
+#endif
+
+#if OPT_A3 // ASIDs
+	/*
+	 * ASID generation this cpu's TLB was last flushed in. Entries
+	 * from older generations may carry ASIDs that have been handed
+	 * out again, so the TLB is flushed before using a newer one.
+	 */
+	uint32_t c_tlbgen;
+#endif
+
+#if OPT_A3 // TLB replacement
+	/*
+	 * Software TLB replacement state (see mips/tlbpolicy.h): the
+	 * next slot to consider and a use bit per slot.
+	 */
+	unsigned c_tlbhand;
+	uint64_t c_tlbref;
+#endif
+
+	/*
+	 * This cpu's share of the uw-vmstats counters, which are summed
+	 * over all cpus when read. Interrupts must be off to update them.
+	 */
+	unsigned c_vmstats[VMSTAT_COUNT];
+
+	/*
+	 * Scheduler statistics, for schedule_printstats. Protected by
+	 * the runqueue lock.
+	 */
+	unsigned c_sched_runs[SCHED_NLEVELS];	 /* threads taken off each queue */
+	uint64_t c_sched_waited[SCHED_NLEVELS];	 /* hardclocks they had waited */
+	unsigned c_sched_maxlen[SCHED_NLEVELS];	 /* longest each queue got */
+	unsigned c_sched_demotions;	/* time slices used up */
+	unsigned c_sched_boosts;	/* starvation boosts */
+	unsigned c_sched_steals;	/* threads taken from other cpus */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by priority */
+	unsigned c_nrunnable;		/* Threads on all of them */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -106,6 +166,13 @@ struct cpu {
  */
 struct cpu *cpu_create(unsigned hardware_number);
 void cpu_machdep_init(struct cpu *);
+
+/*
+ * Iterate over the CPUs: cpu_numcpus returns how many have been
+ * created, cpu_getbynumber the one whose c_number is NUM.
+ */
+unsigned cpu_numcpus(void);
+struct cpu *cpu_getbynumber(unsigned num);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
@@ -152,6 +219,7 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_all is like ipi_tlbshootdown but flushes the whole TLB.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +234,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_all(struct cpu *target);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,24 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap() and munmap().
+ */
+
+/* Protection; MIPS can't enforce anything but PROT_WRITE. */
+#define PROT_NONE    0
+#define PROT_READ    1
+#define PROT_WRITE   2
+#define PROT_EXEC    4
+
+/* Flags. Exactly one of MAP_SHARED and MAP_PRIVATE must be given. */
+#define MAP_SHARED   0x0001	/* Writes go to the file. */
+#define MAP_PRIVATE  0x0002	/* Writes are copy-on-write. */
+#define MAP_FIXED    0x0010	/* Map at exactly addr (not supported). */
+#define MAP_ANON     0x1000	/* Zero-filled memory, no file. */
+
+/* What mmap() returns on error. */
+#define MAP_FAILED   ((void *)-1)
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,20 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * Definitions for __getvmstat().
+ */
+
+/* Whose statistics to get. */
+#define VMS_SELF     0	/* The calling process. */
+#define VMS_SYSTEM   1	/* Every process since boot. */
+
+struct vmstat {
+	unsigned vms_faults;	/* TLB misses that went to vm_fault */
+	unsigned vms_reloads;	/* ...for pages that were already in memory */
+	unsigned vms_swapins;	/* Pages read back in from swap */
+	unsigned vms_resident;	/* Pages in memory now (VMS_SYSTEM: frames) */
+};
+
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -0,0 +1,84 @@
+#ifndef _KMEM_H_
+#define _KMEM_H_
+
+/*
+ * Object caches on top of kmalloc.
+ *
+ * A cache hands out objects of one type and keeps freed ones for
+ * reuse, still constructed: the constructor runs when an object is
+ * first made and the destructor only when its memory goes back to
+ * kmalloc, so whatever they set up (wait channels, arrays and so on)
+ * is paid for once rather than on every create/destroy. Objects must
+ * be freed back in the state the constructor left them in.
+ *
+ * Each cpu keeps a magazine of up to KMEM_MAGSIZE free objects it can
+ * allocate from and free to with interrupts off and no lock. Whole
+ * magazines are exchanged with a per-cache depot, which holds at most
+ * KMEM_DEPOT_MAX full ones (or fewer, for caches of big objects set
+ * up with KMEM_CACHE_INITIALIZER_DEPOT); objects freed beyond that are
+ * destroyed.
+ *
+ * Caches are declared statically with KMEM_CACHE_INITIALIZER, so they
+ * work from the first kmalloc on, before any cpu exists (until then
+ * everything goes straight to kmalloc).
+ *
+ * Functions:
+ *     kmem_cache_alloc - return an object, constructed, or NULL if out
+ *                        of memory or the constructor failed.
+ *     kmem_cache_free  - give an object back to its cache.
+ *     kmem_reap        - destroy the objects in every cache's depot.
+ *                        Called when memory is short (see vm_reclaim).
+ *     kmem_printstats  - print each cache's hit rate and depot size.
+ */
+
+#include <spinlock.h>
+#include <platform/maxcpus.h>
+
+#define KMEM_MAGSIZE	14	/* so a magazine is 64 bytes */
+#define KMEM_DEPOT_MAX	8
+
+struct kmem_magazine {
+	struct kmem_magazine *km_next;
+	unsigned km_nrounds;
+	void *km_rounds[KMEM_MAGSIZE];
+};
+
+/* Accessed only by its cpu, with interrupts off. */
+struct kmem_cpu {
+	struct kmem_magazine *kcc_loaded;
+	unsigned kcc_hits;	/* allocs served from a magazine */
+	unsigned kcc_misses;	/* allocs that had to construct an object */
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;
+	int (*kc_ctor)(void *obj);	/* returns an error code */
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;	/* protects the rest */
+	struct kmem_magazine *kc_full;	/* depot */
+	struct kmem_magazine *kc_empty;
+	unsigned kc_nfull;
+	unsigned kc_depotmax;		/* most full magazines to keep */
+	unsigned kc_destroyed;		/* frees that found the depot full */
+	bool kc_listed;			/* on the list kmem_printstats walks */
+	struct kmem_cache *kc_next;
+
+	struct kmem_cpu kc_cpu[MAXCPUS];
+};
+
+#define KMEM_CACHE_INITIALIZER_DEPOT(name, type, ctor, dtor, depotmax) \
+	{ .kc_name = (name), .kc_size = sizeof(type), \
+	  .kc_ctor = (ctor), .kc_dtor = (dtor), \
+	  .kc_lock = SPINLOCK_INITIALIZER, .kc_depotmax = (depotmax) }
+#define KMEM_CACHE_INITIALIZER(name, type, ctor, dtor) \
+	KMEM_CACHE_INITIALIZER_DEPOT(name, type, ctor, dtor, KMEM_DEPOT_MAX)
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void  kmem_cache_free(struct kmem_cache *kc, void *obj);
+void  kmem_reap(void);
+void  kmem_printstats(void);
+
+
+#endif /* _KMEM_H_ */
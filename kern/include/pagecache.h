@@ -0,0 +1,49 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for memory-mapped files.
+ *
+ * Pages of files mapped with mmap are kept in frames of their own,
+ * looked up by (vnode, offset), and mapped straight into every address
+ * space that maps them: there is no copy through uiomove. The cache
+ * holds one coremap reference to each frame and every mapping another,
+ * so a page is in use while coremap_is_shared says so. Pages nobody
+ * maps any more stay cached until the cache fills up or
+ * pagecache_reclaim is called.
+ *
+ * A page that may have been written through a shared mapping is dirty
+ * and is written back by pagecache_flush and when it is dropped. Only
+ * the part of a page inside the file is written; mappings never change
+ * a file's size. read() and write() go around the cache.
+ *
+ * Functions:
+ *     pagecache_bootstrap - set up the cache. Called once kmalloc works.
+ *     pagecache_get       - hand back in PADDR the frame holding the
+ *                           page of V at OFFSET (page-aligned), with a
+ *                           reference added for the caller's mapping.
+ *                           It is read in on a miss, which sets READIN;
+ *                           past the end of the file it reads as zeroes.
+ *     pagecache_dirty     - note that the page of V at OFFSET, which
+ *                           must be mapped, is mapped writable.
+ *     pagecache_flush     - write the dirty pages of V back to the file,
+ *                           or those of every file if V is NULL.
+ *     pagecache_reclaim   - drop the pages nobody maps, writing back the
+ *                           dirty ones. Returns how many frames it freed.
+ *                           May sleep. Called by the page allocator when
+ *                           it runs out, before anything is swapped out;
+ *                           does nothing if the cache itself is the one
+ *                           allocating.
+ */
+
+struct vnode;
+
+void pagecache_bootstrap(void);
+int  pagecache_get(struct vnode *v, off_t offset, paddr_t *paddr,
+		   bool *readin);
+void pagecache_dirty(struct vnode *v, off_t offset);
+int  pagecache_flush(struct vnode *v);
+unsigned pagecache_reclaim(void);
+
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,80 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level user page tables.
+ *
+ * A user virtual address is split into a 9-bit directory index (user
+ * space is 2GB), a 10-bit table index and the page offset. Each
+ * second-level table is one page of 1024 entries, covering 4MB of
+ * address space, and is only allocated once a page in it is defined.
+ *
+ * Page table entry format:
+ *     bits 31-12   frame address, or swap slot if PTE_SWAPPED (swap.h)
+ *     PTE_VALID    the page belongs to a region of the address space
+ *     PTE_WRITE    the page may be written (once the executable is loaded)
+ *     PTE_SWAPPED  the page is in swap
+ *     PTE_SHARED   writes go to the frame even if it is shared (a
+ *                  MAP_SHARED file mapping; see pagecache.h)
+ *     PTE_TLBVALID, PTE_TLBDIRTY
+ *                  the entry may be loaded into the TLB as is, without
+ *                  the low 8 bits, by the refill fast path in
+ *                  exception-mips1.S (they are TLBLO_VALID/TLBLO_DIRTY)
+ *     PTE_PREFETCH the page was loaded into the TLB by fault-around and
+ *                  has not faulted since. It replaces PTE_TLBVALID, so
+ *                  that a later miss shows up in vm_fault (and is
+ *                  counted) instead of in the fast path; PTE_TLBDIRTY
+ *                  keeps saying whether it may be written.
+ * An entry without PTE_VALID is not part of the address space. A valid
+ * entry with neither a frame nor PTE_SWAPPED has never been touched.
+ * vm_fault sets PTE_TLBVALID on resident pages, and PTE_TLBDIRTY as well
+ * if it lets them be written. Sharing a frame copy-on-write clears
+ * PTE_TLBDIRTY; anything that evicts or moves the page clears all three
+ * (PTE_TLBBITS). Bits 0x100 (global) and 0x800 (uncached) are never set.
+ *
+ * Functions:
+ *     pt_create  - make an empty page table. Returns NULL if out of memory.
+ *     pt_destroy - free a page table with every frame and swap slot its
+ *                  entries hold.
+ *     pt_lookup  - return the entry for VADDR. If its second-level table
+ *                  does not exist, it is made if CREATE is set, otherwise
+ *                  (or if out of memory) NULL is returned.
+ *     pt_copy    - make NEW map the same pages as OLD, sharing frames and
+ *                  swap slots copy-on-write. NEW must be empty.
+ *     pt_resident - count the entries that map a frame. Nothing is
+ *                  pinned, so pages on their way to swap may be off.
+ */
+
+#include <vm.h>
+
+#define PTE_SWAPPED	0x1
+#define PTE_VALID	0x2
+#define PTE_WRITE	0x4
+#define PTE_SHARED	0x8
+#define PTE_PREFETCH	0x10
+#define PTE_PERMS	(PTE_VALID | PTE_WRITE | PTE_SHARED)
+#define PTE_TLBVALID	0x200
+#define PTE_TLBDIRTY	0x400
+#define PTE_TLBBITS	(PTE_TLBVALID | PTE_TLBDIRTY | PTE_PREFETCH)
+
+#define PTE_FRAME(pte)		((pte) & PAGE_FRAME)
+#define PTE_ISSWAPPED(pte)	(((pte) & PTE_SWAPPED) != 0)
+#define PTE_ISRESIDENT(pte)	(PTE_FRAME(pte) != 0 && !PTE_ISSWAPPED(pte))
+
+#define PT_DIRSIZE	(USERSPACETOP >> 22)
+#define PT_TABLESIZE	(PAGE_SIZE / sizeof(paddr_t))
+#define PT_DIRINDEX(vaddr)	((vaddr) >> 22)
+#define PT_TABLEINDEX(vaddr)	(((vaddr) >> 12) & (PT_TABLESIZE - 1))
+
+struct pagetable {
+	paddr_t *pt_dir[PT_DIRSIZE];
+};
+
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt);
+paddr_t          *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int               pt_copy(struct pagetable *new, struct pagetable *old);
+unsigned          pt_resident(struct pagetable *pt);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -40,12 +40,17 @@
 #include <thread.h> /* required for struct threadarray */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <synch.h>
+#if OPT_A3
+#include <kern/vmstat.h>
+#endif
 
 struct addrspace;
 struct vnode;
 #ifdef UW
 struct semaphore;
+struct kmem_cache;
 #endif // UW
 
 #if OPT_A2
@@ -87,6 +92,12 @@ struct proc {
 	  struct cv *child_cv;    
 	#endif
 
+#if OPT_A3 // vm stats
+	/* counted by vm_fault as we run; vms_resident is worked out
+	   when asked for (see sys___getvmstat) */
+	struct vmstat p_vmstat;
+#endif
+
 };
 
 
@@ -98,6 +109,9 @@ struct child {
     int exit_code; 
     struct proc *location;
 };
+
+/* child records come from here (see kmem.h) */
+extern struct kmem_cache child_cache;
 #endif
 
 
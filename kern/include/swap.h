@@ -0,0 +1,42 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * When no free frame is left, user pages are written out to page-sized
+ * slots on a raw disk and the frame in their page table entry is
+ * replaced with the slot number and PTE_SWAPPED (see pagetable.h). The
+ * next fault on the page reads it back.
+ *
+ * Slots are reference counted like frames, so a page that was swapped
+ * out when its address space was forked stays shared on disk.
+ *
+ * Functions:
+ *     swap_bootstrap - open the swap disk. Paging is disabled if it is
+ *                      missing.
+ *     swap_evict     - pick a victim frame with the clock algorithm and
+ *                      write it out. Returns 0 if a frame was freed.
+ *                      Only called where it is safe to sleep.
+ *     swap_pagein    - read the page in swap entry PTE into the frame
+ *                      at PADDR and drop that reference to the slot.
+ *     swap_share     - add a reference to the slot in swap entry PTE.
+ *     swap_free      - drop a reference to the slot in swap entry PTE.
+ */
+
+#include <vm.h>
+#include <pagetable.h>
+
+#define SWAP_DEVICE "lhd1raw:"
+
+#define SWAP_PTE(slot)		((paddr_t)(slot) * PAGE_SIZE | PTE_SWAPPED)
+#define SWAP_SLOT(pte)		((unsigned)(((pte) & PAGE_FRAME) / PAGE_SIZE))
+
+void swap_bootstrap(void);
+int  swap_evict(void);
+int  swap_pagein(paddr_t pte, paddr_t paddr);
+void swap_share(paddr_t pte);
+void swap_free(paddr_t pte);
+
+
+#endif /* _SWAP_H_ */
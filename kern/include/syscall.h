@@ -31,8 +31,10 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct kmem_cache; /* from <kmem.h> */
 
 /*
  * The system call dispatcher.
@@ -46,6 +48,8 @@ void syscall(struct trapframe *tf);
 
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
+/* enter_forked_process frees TF, which comes from here (see kmem.h) */
+extern struct kmem_cache trapframe_cache;
 
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
@@ -74,4 +78,12 @@ int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t program, userptr_t args);   
 #endif
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+             vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys___getvmstat(int who, userptr_t buf);
+#endif
+
 #endif /* _SYSCALL_H_ */
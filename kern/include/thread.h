@@ -84,6 +84,16 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields (see schedule() in thread.c). Changed only
+	 * while the thread is running, or with it off every run queue
+	 * or holding the lock of the one it is on.
+	 */
+	unsigned t_priority;		/* Run queue level, 0 is highest */
+	unsigned t_slice;		/* Hardclocks left at this level */
+	unsigned t_readysince;		/* sched tick it became runnable */
+	bool t_fixedprio;		/* t_priority never changes */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -157,11 +167,36 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Destroy the threads that have exited on this cpu and not yet been
+ * cleaned up. Interrupts need not be disabled.
+ */
+void thread_reap(void);
+
+/*
+ * Charge the current thread for one hardclock and yield if its time
+ * slice is used up or a higher-priority thread is waiting. Called
+ * from the timer interrupt instead of thread_yield.
+ */
+void thread_tick(void);
+
+/*
+ * Put the current thread at run queue level LEVEL for good: it is no
+ * longer moved down for using up its slice, nor up on wakeup or by the
+ * periodic boost. SCHED_NLEVELS-1 makes a background thread.
+ */
+void thread_setpriority(unsigned level);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Print each cpu's run queue lengths, wait times and the like.
+ */
+void schedule_printstats(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -36,7 +36,15 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_TLB_REPLACE_RANDOM    (10)
+#define VMSTAT_TLB_REPLACE_ROUNDROBIN (11)
+#define VMSTAT_TLB_REPLACE_CLOCK     (12)
+#define VMSTAT_TLB_SECOND_CHANCE     (13)
+#define VMSTAT_MMAP_FILE_READ        (14)
+#define VMSTAT_TLB_FAULTAROUND       (15)
+#define VMSTAT_TLB_FAULTAROUND_REPLACE (16)
+#define VMSTAT_TLB_FAULTAROUND_REFAULT (17)
+#define VMSTAT_COUNT                 (18)
 
 /* ----------------------------------------------------------------------- */
 
@@ -49,9 +57,12 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
  *   vmstats_inc(VMSTAT_TLB_FAULT);
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
-void vmstats_inc(unsigned int index);    /* uses locking */
+void vmstats_inc(unsigned int index);    /* per-cpu, with interrupts off; no lock */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Sum the statistics over all cpus into COUNTS */
+void vmstats_read(unsigned int counts[VMSTAT_COUNT]);  /* Does NOT use locking */
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
 
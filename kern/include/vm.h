@@ -55,8 +55,35 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Low-memory hook: free what can be had without taking pages away from
+ * anyone (exited threads, cached objects, unmapped file pages, cached
+ * free frames) before an allocation is given up on. Returns about how
+ * many pages that was, not counting objects. May sleep.
+ */
+unsigned vm_reclaim(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Remove VADDR (or the pages from START to END) of AS from the TLB of
+ * every cpu that may hold it, waiting until it is gone. The page table
+ * must already say what the TLB should see from now on.
+ */
+struct addrspace;
+void vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr);
+void vm_tlbinvalidate_range(struct addrspace *as, vaddr_t start, vaddr_t end);
+
+/*
+ * Fault-around: a TLB miss also preloads entries for the resident pages
+ * of the same region in the aligned window of vm_faultaround pages
+ * around it. 0 (the default) turns it off. vm_setfaultaround checks
+ * that NPAGES is 0 or a power of two up to VM_FAULTAROUND_MAX.
+ */
+#define VM_FAULTAROUND_MAX   16
+extern unsigned vm_faultaround;
+int vm_setfaultaround(unsigned npages);
+
 #endif /* _VM_H_ */
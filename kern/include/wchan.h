@@ -49,6 +49,12 @@ struct wchan *wchan_create(const char *name);
  */
 void wchan_destroy(struct wchan *wc);
 
+/*
+ * Change the symbolic name of a wait channel that is kept across
+ * uses (see kmem.h). Must be empty. The same rules for NAME apply.
+ */
+void wchan_setname(struct wchan *wc, const char *name);
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
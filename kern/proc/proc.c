@@ -52,14 +52,30 @@
 #include <kern/fcntl.h>  
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <limits.h>
-//#include <kern/errno.h>
+#include <kern/errno.h>
+#include <kmem.h>
 
 #if OPT_A2
 volatile pid_t pid_counter;
 struct lock *lk;
 #endif
 
+/*
+ * Processes are cached with their lock, thread array and (A2) child
+ * bookkeeping set up; see kmem.h.
+ */
+static int proc_ctor(void *obj);
+static void proc_dtor(void *obj);
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", struct proc, proc_ctor, proc_dtor);
+
+#if OPT_A2
+struct kmem_cache child_cache =
+	KMEM_CACHE_INITIALIZER("child", struct child, NULL, NULL);
+#endif
+
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
@@ -82,6 +98,54 @@ struct semaphore *no_proc_sem;
 
 
 
+/*
+ * Set up and tear down the parts of a proc structure that stay with
+ * it in proc_cache.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+
+#if OPT_A2
+	proc->child_cv = cv_create("child_cv");
+	if (proc->child_cv == NULL) {
+		goto fail;
+	}
+	proc->children = array_create();
+	if (proc->children == NULL) {
+		cv_destroy(proc->child_cv);
+		goto fail;
+	}
+#endif
+	return 0;
+
+#if OPT_A2
+ fail:
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	return ENOMEM;
+#endif
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+#if OPT_A2
+	array_destroy(proc->children);
+	cv_destroy(proc->child_cv);
+#endif
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -92,19 +156,16 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
-
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -116,23 +177,21 @@ proc_create(const char *name)
 #endif // UW
 
 #if OPT_A2
-    proc->child_cv = cv_create("child_cv");
-	if (proc->child_cv == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
+    // child_cv and children come from proc_cache
+    KASSERT(array_num(proc->children) == 0);
 
     // assign pid
 	proc->pid = pid_counter;
 	pid_counter += 1;
 
     proc->parent = NULL;
-	proc->children = array_create();
-    array_init(proc->children); 
 
 #endif
 
+#if OPT_A3 // vm stats
+	bzero(&proc->p_vmstat, sizeof(proc->p_vmstat));
+#endif
+
 	return proc;
 }
 
@@ -202,20 +261,19 @@ proc_destroy(struct proc *proc)
     for (int i = array_num(proc->children) - 1; i >= 0; i--) {
         struct child *curchild = array_get(proc->children, i);
         curchild->location->parent = NULL;
-        kfree(curchild); 
+        kmem_cache_free(&child_cache, curchild); 
         array_remove(proc->children, i);
     }
-    array_destroy(proc->children);
+    // the empty array and child_cv go back to proc_cache with proc
 
 	lock_release(lk);
-    cv_destroy(proc->child_cv);
 #endif
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	/* the thread array and spinlock are kept as well */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -285,13 +343,24 @@ proc_create_runprogram(const char *name)
 	}
 
 #ifdef UW
-	/* open the console - this should always succeed */
+	/* increment the count of processes */
+        /* we are assuming that all procs, including those created by fork(),
+           are created using a call to proc_create_runprogram  */
+	/* (done first, so that proc_destroy can undo anything below) */
+	P(proc_count_mutex); 
+	proc_count++;
+	V(proc_count_mutex);
+
+	/* open the console - this only fails if memory is short */
 	console_path = kstrdup("con:");
 	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
+	  proc_destroy(proc);
+	  return NULL;
 	}
 	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
+	  kfree(console_path);
+	  proc_destroy(proc);
+	  return NULL;
 	}
 	kfree(console_path);
 #endif // UW
@@ -319,15 +388,6 @@ proc_create_runprogram(const char *name)
 	spinlock_release(&curproc->p_lock);
 #endif // UW
 
-#ifdef UW
-	/* increment the count of processes */
-        /* we are assuming that all procs, including those created by fork(),
-           are created using a call to proc_create_runprogram  */
-	P(proc_count_mutex); 
-	proc_count++;
-	V(proc_count_mutex);
-#endif // UW
-
 	return proc;
 }
 
@@ -51,6 +51,9 @@
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
+#include "opt-A3.h"
+#include <uw-vmstats.h>
+
 
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -153,6 +156,10 @@ shutdown(void)
 
 	thread_shutdown();
 
+#if OPT_A3 // demand paging
+	vmstats_print();
+#endif
+
 	splhigh();
 }
 
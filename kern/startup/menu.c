@@ -42,11 +42,19 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmem.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+#if OPT_A3 // vm stats
+#include <vm.h>
+#include <uw-vmstats.h>
+#include <coremap.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -405,10 +413,64 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_printstats();
 	
 	return 0;
 }
 
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	schedule_printstats();
+
+	return 0;
+}
+
+#if OPT_A3 // vm stats
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmstats_print();
+	coremap_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the fault-around window.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		kprintf("fault-around: %u pages\n", vm_faultaround);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: fa [npages]\n");
+		return EINVAL;
+	}
+
+	result = vm_setfaultaround(atoi(args[1]));
+	if (result) {
+		kprintf("fa: window must be 0 or a power of two up to %d\n",
+			VM_FAULTAROUND_MAX);
+	}
+	return result;
+}
+#endif
+
 
 // newly added for A0
 // command for dth
@@ -463,6 +525,9 @@ static const char *opsmenu[] = {
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
         "[dth]     Enable Dubug of DB_THREADS",
+#if OPT_A3
+	"[fa]      Set fault-around window   ",
+#endif
 	NULL
 };
 
@@ -532,6 +597,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ss] Scheduler stats                ",
+#if OPT_A3
+	"[vm] VM stats                       ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -578,6 +647,9 @@ static struct {
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
         { "dth",	cmd_dth },
+#if OPT_A3
+	{ "fa",		cmd_faultaround },
+#endif
 
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
@@ -590,6 +662,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ss",         cmd_schedstats },
+#if OPT_A3
+	{ "vm",         cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
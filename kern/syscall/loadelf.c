@@ -45,6 +45,10 @@
  * If you wanted to support memory-mapped executables you would need
  * to rearrange this to map each segment.
  *
+ * (With OPT_A3 this is what happens: instead of reading each segment
+ * in, as_define_backing records where it lives in the file and
+ * vm_fault reads pages in on first touch.)
+ *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
  * linker). And you'd have to write a dynamic linker...
@@ -76,6 +80,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if !OPT_A3 // demand paging replaces eager segment loading
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -146,6 +151,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#endif /* !OPT_A3 */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -261,7 +267,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now actually load each segment. (Under OPT_A3, just tell the
+	 * address space where each one comes from.)
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -290,9 +297,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_A3 // demand paging
+		result = as_define_backing(as, v, ph.p_offset, ph.p_vaddr,
+					   ph.p_memsz, ph.p_filesz);
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
@@ -307,7 +319,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 
 #if OPT_A3 // read-only text seg
 	as->as_loadelf_complete = true;
-	as_activate();
+	as_invalidate(as);
 #endif
 
 	return 0;
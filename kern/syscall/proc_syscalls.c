@@ -9,99 +9,139 @@
 #include <thread.h>
 #include <addrspace.h>
 #include <copyinout.h>
+#include <kmem.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <array.h>
 #include <synch.h>
 #include <mips/trapframe.h>
 #include <limits.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/vmstat.h>
+#if OPT_A3
+#include <pagetable.h>
+#include <coremap.h>
+#include <uw-vmstats.h>
+#endif
 
 #include <test.h>
 
 
 #if OPT_A2
 
-int
-sys_fork(struct trapframe *tf, pid_t *retval)
+// One attempt at fork. Every failure is undone before returning, so
+// that sys_fork can free up memory and try again.
+static int
+fork_once(struct trapframe *tf, pid_t *retval)
 {
-  KASSERT(curproc != NULL);
-  KASSERT(lk != NULL);
-  KASSERT(pid_counter >= PID_MIN);
+  struct proc *new_proc;
+  struct child *curchild;
+  struct trapframe *new_trapframe;
+  unsigned index;
+  int result;
 
   if (pid_counter > PID_MAX) { // check pid_counter
     return ENPROC;
   } 
   
   // 1. create process structure for child process
-  struct proc *new_proc = proc_create_runprogram(curproc->p_name);
+  new_proc = proc_create_runprogram(curproc->p_name);
   if (new_proc == NULL) { //error check
-    panic("sys_fork cannot create a new process");
     return ENOMEM;
   }
 
   // 2. create and copy address space
-  lock_acquire(lk);
-  int err1 = as_copy(curproc_getas(), &(new_proc->p_addrspace));
-  lock_release(lk);
-  if (err1 == 1) { // error check
-    panic("sys_fork cannot copy adress space from parent to child");
+  // (copy-on-write: as_copy only shares frames and does its own
+  // locking on the coremap, so it does not need the global lock)
+  result = as_copy(curproc_getas(), &(new_proc->p_addrspace));
+  if (result) { // error check
     proc_destroy(new_proc);
-    return ENOMEM;
+    return result;
   }  
 
   // 3. assign PID to child process
-  lock_acquire(lk);
-  struct child *curchild = kmalloc(sizeof(struct child)); 
+  curchild = kmem_cache_alloc(&child_cache); 
   if (curchild == NULL) { // error check
-    panic("sys_fork cannot create child structure");
-    as_destroy(new_proc->p_addrspace);
-    proc_destroy(new_proc);
+    result = ENOMEM;
+    goto fail_as;
   }
   curchild->exit = false;
   curchild->exit_code = 0;
   curchild->pid = new_proc->pid; 
   curchild->location = new_proc;
-  lock_release(lk);
-
-  // create the parent/child relationship
-  lock_acquire(lk);
-  array_add(curproc->children, curchild, NULL);
-  new_proc->parent = curproc; 
-  lock_release(lk);
 
   // 4. create new trap frame for child and deep copy from parent
-  lock_acquire(lk);
-  struct trapframe *new_trapframe = kmalloc(sizeof(struct trapframe));
-  lock_release(lk);
+  new_trapframe = kmem_cache_alloc(&trapframe_cache);
   if (new_trapframe == NULL) { // error check
-    panic("sys_fork cannot create new trap frame");
-    as_destroy(new_proc->p_addrspace);
-    proc_destroy(new_proc);
-    kfree(curchild); 
+    result = ENOMEM;
+    goto fail_child;
   }
-  lock_acquire(lk);
   memcpy(new_trapframe, tf, sizeof(struct trapframe));
-  lock_release(lk);
 
-  // 5. create thread for child process
+  // create the parent/child relationship
+  // (only once nothing else can fail before the child runs, except
+  // thread_fork, which is undone below)
   lock_acquire(lk);
-  int err2 = thread_fork(curthread->t_name, new_proc, (void *)&enter_forked_process, new_trapframe, 0);
+  result = array_add(curproc->children, curchild, &index);
+  if (result == 0) {
+    new_proc->parent = curproc; 
+  }
   lock_release(lk);
-  if (err2 == 1) { // error check
-    panic("sys_fork cannot create thread for child process");
-    as_destroy(new_proc->p_addrspace);
-    proc_destroy(new_proc);
-    kfree(curchild); 
-    kfree(new_trapframe);
-    return ENOMEM; 
+  if (result) { // error check
+    goto fail_trapframe;
+  }
+
+  // 5. create thread for child process
+  result = thread_fork(curthread->t_name, new_proc, (void *)&enter_forked_process, new_trapframe, 0);
+  if (result) { // error check
+    // nobody else adds to or removes from our children, so the
+    // record is still where we put it
+    lock_acquire(lk);
+    KASSERT(array_get(curproc->children, index) == curchild);
+    array_remove(curproc->children, index);
+    new_proc->parent = NULL;
+    lock_release(lk);
+    goto fail_trapframe;
   }
 
   // update return value to return child pid
   *retval = new_proc->pid;
 
   return 0;
+
+ fail_trapframe:
+  kmem_cache_free(&trapframe_cache, new_trapframe);
+ fail_child:
+  kmem_cache_free(&child_cache, curchild); 
+ fail_as:
+  // proc_destroy leaves the address space to sys__exit
+  as_destroy(new_proc->p_addrspace);
+  new_proc->p_addrspace = NULL;
+  proc_destroy(new_proc);
+  return result;
+}
+
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+  int result;
+
+  KASSERT(curproc != NULL);
+  KASSERT(lk != NULL);
+  KASSERT(pid_counter >= PID_MIN);
+
+  result = fork_once(tf, retval);
+  if (result == ENOMEM) {
+    // out of memory: free what we can without hurting anyone
+    // (exited threads, unmapped file pages, cached frames) and try
+    // once more before giving up
+    vm_reclaim();
+    result = fork_once(tf, retval);
+  }
+  return result;
 }
 #endif
 
@@ -319,13 +359,7 @@ sys_execv(userptr_t program, userptr_t args) {
   vaddr_t entrypoint, stackptr;
   int result;
 
-  if (program == NULL) {
-    panic("sys_execv: program did not exist\n");
-    return ENOENT;
-  }
-
-  if (args == NULL) {
-    panic("sys_execv: One of the args is an invalid pointer.\n");
+  if (program == NULL || args == NULL) {
     return EFAULT;
   }
 
@@ -333,42 +367,39 @@ sys_execv(userptr_t program, userptr_t args) {
   char* args_array[65]; // store ptr to each arguments 
   int args_len[65];     // store size of each arguments
   int count = 0;        // count number of arguments (do not include NULL terminator)
-  for (int i = 0; i < 65; i++){
-    userptr_t temp;
-    result = copyin(args + i * 4, &temp, sizeof(userptr_t));
-    if (result) {
-      panic("sys_execv: fail in copyin function\n");
-      return result;
-    }
+  userptr_t args_ptrs[65]; // the user's argv, NULL terminator included
+  size_t nptrs;
 
-    if (temp == NULL) { // check NULL terminator -> STOP
-      break;
-    }
+  // every pointer in one go; E2BIG if there is no NULL among them
+  result = copyin_ptrarray(args, args_ptrs, 65, &nptrs);
+  if (result) {
+    return result;
+  }
+  for (int i = 0; i < (int)nptrs; i++){
+    userptr_t temp = args_ptrs[i];
 
     count += 1; 
     
     args_array[i] = kmalloc(sizeof(char) * PATH_MAX); // allocate space for each argument
+    if (args_array[i] == NULL) {
+      // low on memory: see if anything can be given back first
+      vm_reclaim();
+      args_array[i] = kmalloc(sizeof(char) * PATH_MAX);
+    }
     if (args_array[i] == NULL) {
       for (int j = 0; j < i; j++) {
         kfree(args_array[j]);
       }
-      panic("sys_execv: fail on allocating spacr for each argument\n");
       return ENOMEM;
     }
     result = copyinstr(temp, args_array[i], PATH_MAX, (size_t *)&args_len[i]);
     if (result) {
-      for (int j = 0; j < i; j++) {
+      for (int j = 0; j <= i; j++) {
         kfree(args_array[j]);
       }      
-      panic("sys_execv: fail in copyinstr function\n");
       return result;
     }
   }
-  
-  if (args_array[count] != NULL) {
-    panic("sys_execv: The total size of the argument strings is too large\n");
-    return E2BIG;
-  }
 
 
   //// 2. copy the program path into the kernel ////
@@ -384,7 +415,7 @@ sys_execv(userptr_t program, userptr_t args) {
 
   //// 3. open the program file using vfs_open(prog_name, ...)*////
   /* Open the file. */
-  result = vfs_open((char *)program, O_RDONLY, 0, &v);
+  result = vfs_open(progName, O_RDONLY, 0, &v);
   if (result) {
     for (int i = 0; i < count; i ++) {
       kfree(args_array[i]);
@@ -396,6 +427,10 @@ sys_execv(userptr_t program, userptr_t args) {
   //// 4. create new address space, set process to the new address space, and activate it ////
   /* Create a new address space. */
   as = as_create();
+  if (as == NULL) {
+    vm_reclaim();
+    as = as_create();
+  }
   if (as == NULL) {
     for (int i = 0; i < count; i ++) {
       kfree(args_array[i]);
@@ -491,3 +526,68 @@ sys_execv(userptr_t program, userptr_t args) {
 #endif
 
 
+
+#if OPT_A3
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  struct addrspace *as = curproc_getas();
+
+  KASSERT(as != NULL);
+  return as_sbrk(as, amount, retval);
+}
+
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, vaddr_t *retval)
+{
+  struct addrspace *as = curproc_getas();
+
+  KASSERT(as != NULL);
+  (void)addr; // only a hint, and MAP_FIXED is not supported
+
+  // there is no file table to look a descriptor up in, so from user
+  // level only anonymous memory can be mapped (fd and offset, on the
+  // stack, are not even read)
+  if ((flags & MAP_ANON) == 0) {
+    return EBADF;
+  }
+  return as_mmap(as, NULL, 0, len, prot, flags, retval);
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+  struct addrspace *as = curproc_getas();
+
+  KASSERT(as != NULL);
+  return as_munmap(as, (vaddr_t)addr, len);
+}
+
+int
+sys___getvmstat(int who, userptr_t buf)
+{
+  struct vmstat vs;
+  struct addrspace *as;
+  unsigned int counts[VMSTAT_COUNT];
+
+  switch (who) {
+    case VMS_SELF:
+      vs = curproc->p_vmstat;
+      as = curproc_getas();
+      vs.vms_resident = as == NULL ? 0 : pt_resident(as->as_pt);
+      break;
+    case VMS_SYSTEM:
+      // the same events, from the global counters
+      vmstats_read(counts);
+      vs.vms_faults = counts[VMSTAT_TLB_FAULT];
+      vs.vms_reloads = counts[VMSTAT_TLB_RELOAD];
+      vs.vms_swapins = counts[VMSTAT_SWAP_FILE_READ];
+      vs.vms_resident = coremap_inuse();
+      break;
+    default:
+      return EINVAL;
+  }
+
+  return copyout(&vs, buf, sizeof(vs));
+}
+#endif
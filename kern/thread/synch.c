@@ -33,17 +33,55 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <kmem.h>
+
+/*
+ * Semaphores, locks and cvs come from object caches that keep them
+ * with their wait channel and spinlock set up. The wait channel is
+ * named after the object while it is in use; in the cache it goes
+ * back to a constant name, as the object's own name is freed.
+ */
+#define SYNCH_FREE_NAME "(free)"
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static
+int
+sem_ctor(void *obj)
+{
+	struct semaphore *sem = obj;
+
+	sem->sem_wchan = wchan_create(SYNCH_FREE_NAME);
+	if (sem->sem_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&sem->sem_lock);
+	return 0;
+}
+
+static
+void
+sem_dtor(void *obj)
+{
+	struct semaphore *sem = obj;
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&sem->sem_lock);
+	wchan_destroy(sem->sem_wchan);
+}
+
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", struct semaphore, sem_ctor, sem_dtor);
+
 struct semaphore *
 sem_create(const char *name, int initial_count)
 {
@@ -51,25 +89,18 @@ sem_create(const char *name, int initial_count)
 
         KASSERT(initial_count >= 0);
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = kmem_cache_alloc(&sem_cache);
         if (sem == NULL) {
                 return NULL;
         }
 
         sem->sem_name = kstrdup(name);
         if (sem->sem_name == NULL) {
-                kfree(sem);
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
-
-	spinlock_init(&sem->sem_lock);
+	wchan_setname(sem->sem_wchan, sem->sem_name);
         sem->sem_count = initial_count;
 
         return sem;
@@ -79,12 +110,12 @@ void
 sem_destroy(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
+	/* the spinlock stays set up in the cache, but nobody may hold it */
+	KASSERT(sem->sem_lock.lk_holder == NULL);
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
+	wchan_setname(sem->sem_wchan, SYNCH_FREE_NAME);
         kfree(sem->sem_name);
-        kfree(sem);
+        kmem_cache_free(&sem_cache, sem);
 }
 
 void 
@@ -147,6 +178,33 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_wchan = wchan_create(SYNCH_FREE_NAME);
+	if (lock->lk_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&lock->lk_lock);
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
+}
+
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", struct lock, lock_ctor, lock_dtor);
+
 struct lock *
 lock_create(const char *name)
 {
@@ -154,14 +212,14 @@ lock_create(const char *name)
 
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
        
@@ -169,14 +227,8 @@ lock_create(const char *name)
         // add stuff here as needed
 	
 	// A1 start
-        lock->lk_wchan = wchan_create(lock->lk_name);
-        if (lock->lk_wchan == NULL) {
-        	kfree(lock->lk_name);
-                kfree(lock);
-                return NULL;
-        }
-	
-        spinlock_init(&lock->lk_lock);
+	// (the wchan and spinlock come ready from lock_cache)
+        wchan_setname(lock->lk_wchan, lock->lk_name);
         
         lock->lk_owner = NULL;
 	lock->lk_held = false;
@@ -193,13 +245,14 @@ lock_destroy(struct lock *lock)
         // add stuff here as needed
 	
 	// A1 start
+	// the spinlock stays set up in the cache, but nobody may hold it
+	KASSERT(lock->lk_lock.lk_holder == NULL);
 	lock->lk_owner = NULL; 
-        spinlock_cleanup(&lock->lk_lock);
-        wchan_destroy(lock->lk_wchan);
+        wchan_setname(lock->lk_wchan, SYNCH_FREE_NAME);
         // A1 end
 	
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(&lock_cache, lock);
 }
 
 void
@@ -267,19 +320,44 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+static
+int
+cv_ctor(void *obj)
+{
+	struct cv *cv = obj;
+
+	cv->cv_wchan = wchan_create(SYNCH_FREE_NAME);
+	if (cv->cv_wchan == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+	struct cv *cv = obj;
+
+	wchan_destroy(cv->cv_wchan);
+}
+
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", struct cv, cv_ctor, cv_dtor);
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
         
@@ -287,12 +365,8 @@ cv_create(const char *name)
 
 
 	// A1 start
-        cv->cv_wchan = wchan_create(cv->cv_name);
-        if (cv->cv_wchan == NULL) {
-                kfree(cv->cv_name);
-                kfree(cv);
-                return NULL;
-        }
+	// (the wchan comes ready from cv_cache)
+        wchan_setname(cv->cv_wchan, cv->cv_name);
         // A1 end
 
         return cv;
@@ -307,11 +381,11 @@ cv_destroy(struct cv *cv)
 
 
 	// A1 start
-        wchan_destroy(cv->cv_wchan);
+        wchan_setname(cv->cv_wchan, SYNCH_FREE_NAME);
         // A1 end
 
         kfree(cv->cv_name);
-        kfree(cv);
+        kmem_cache_free(&cv_cache, cv);
 }
 
 void
@@ -50,8 +50,14 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <coremap.h>
+#endif
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -64,6 +70,18 @@ struct wchan {
 	struct spinlock wc_lock;	/* lock for mutual exclusion */
 };
 
+/*
+ * Time slice, in hardclocks, at each run queue level. A thread that
+ * uses up its slice moves down a level; see thread_tick.
+ */
+static const unsigned sched_slices[SCHED_NLEVELS] = { 1, 2, 4, 8 };
+
+/* Move everything back to level 0 this often (see schedule). */
+#define SCHED_BOOST_HARDCLOCKS	100
+
+/* Hardclocks since boot, as counted on cpu 0, for run queue wait times. */
+static volatile unsigned sched_ticks;
+
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -72,21 +90,38 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Thread structures and kernel stacks (see kmem.h), so that fork and
+ * exit mostly trade them with this cpu's magazines instead of going to
+ * kmalloc. Stacks are cached with their guard band set up, and only
+ * come back after thread_checkstack. They are STACK_SIZE aligned, as
+ * SAME_STACK needs, because kmalloc gives whole pages for them. Being
+ * a page each, at most one magazine of them is kept past the cpus'.
+ */
+static int thread_checkstack_init(void *stack);
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", struct thread, NULL, NULL);
+static struct kmem_cache stack_cache =
+	KMEM_CACHE_INITIALIZER_DEPOT("stack", char[STACK_SIZE],
+				     thread_checkstack_init, NULL, 1);
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Stick a magic number on the bottom end of the stack. This will
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
- * to test this.
+ * to test this. This is stack_cache's constructor, so a stack only
+ * gets it once, however many threads use it.
  */
 static
-void
-thread_checkstack_init(struct thread *thread)
+int
+thread_checkstack_init(void *stack)
 {
-	((uint32_t *)thread->t_stack)[0] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[1] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[2] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[0] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[1] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[2] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[3] = THREAD_STACK_MAGIC;
+	return 0;
 }
 
 /*
@@ -123,14 +158,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -144,6 +179,12 @@ thread_create(const char *name)
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 
+	/* Scheduler fields */
+	thread->t_priority = 0;
+	thread->t_slice = sched_slices[0];
+	thread->t_readysince = 0;
+	thread->t_fixedprio = false;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -168,6 +209,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -181,8 +223,37 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 
+#if OPT_A3 // per-cpu page cache
+	c->c_nfreepages = 0;
+	c->c_freepage_hits = 0;
+	c->c_freepage_misses = 0;
+	c->c_freepage_drains = 0;
+#endif
+
+#if OPT_A3 // ASIDs
+	c->c_tlbgen = 0;
+#endif
+
+#if OPT_A3 // TLB replacement
+	c->c_tlbhand = 0;
+	c->c_tlbref = 0;
+#endif
+
+	for (i = 0; i < VMSTAT_COUNT; i++) {
+		c->c_vmstats[i] = 0;
+	}
+
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+		c->c_sched_runs[i] = 0;
+		c->c_sched_waited[i] = 0;
+		c->c_sched_maxlen[i] = 0;
+	}
+	c->c_nrunnable = 0;
+	c->c_sched_demotions = 0;
+	c->c_sched_boosts = 0;
+	c->c_sched_steals = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -214,11 +285,11 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		/* comes with thread_checkstack_init done */
+		c->c_curthread->t_stack = kmem_cache_alloc(&stack_cache);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
-		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
 
@@ -227,6 +298,25 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of CPUs created so far.
+ */
+unsigned
+cpu_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Fetch a CPU by its software number.
+ */
+struct cpu *
+cpu_getbynumber(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -250,7 +340,9 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		/* the guard band must still be good to be reused */
+		thread_checkstack(thread);
+		kmem_cache_free(&stack_cache, thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -259,7 +351,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -281,6 +373,20 @@ exorcise(void)
 	}
 }
 
+/*
+ * Destroy this cpu's zombies now instead of at the next context
+ * switch, to get their stacks back when memory is short.
+ */
+void
+thread_reap(void)
+{
+	int spl;
+
+	spl = splhigh();
+	exorcise();
+	splx(spl);
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -289,6 +395,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +411,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_nrunnable = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +537,193 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue helpers. The caller holds C's run queue lock.
+ *
+ * runqueue_add puts T at the end of the queue for its priority.
+ * runqueue_remhead takes the first thread from the highest-priority
+ * queue that has one, and runqueue_remtail the last thread from the
+ * lowest; both return NULL if all the queues are empty.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct threadlist *tl;
+
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+	tl = &c->c_runqueue[t->t_priority];
+	threadlist_addtail(tl, t);
+	c->c_nrunnable++;
+	if (tl->tl_count > c->c_sched_maxlen[t->t_priority]) {
+		c->c_sched_maxlen[t->t_priority] = tl->tl_count;
+	}
+}
+
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_nrunnable--;
+			c->c_sched_runs[i]++;
+			c->c_sched_waited[i] += sched_ticks - t->t_readysince;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i = SCHED_NLEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_nrunnable--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * True if C has a runnable thread of higher priority than LEVEL.
+ */
+static
+bool
+runqueue_hashigher(struct cpu *c, unsigned level)
+{
+	unsigned i;
+
+	for (i = 0; i < level; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Work stealing.
+ *
+ * A cpu that runs out of threads takes one from the busiest other cpu
+ * before going idle, instead of waiting for that cpu to push work away
+ * in thread_consider_migration. To respect cache affinity it prefers
+ * threads that have been waiting at least STEAL_COLD_HARDCLOCKS, whose
+ * working set has probably been pushed out by whatever ran meanwhile,
+ * and only takes one that ran just now if the other cpu has at least
+ * STEAL_HOT_MIN threads waiting.
+ */
+#define STEAL_COLD_HARDCLOCKS	2
+#define STEAL_HOT_MIN		2
+
+/*
+ * Take a thread off C's run queues, or return NULL if there is none
+ * worth moving. The caller holds C's run queue lock.
+ */
+static
+struct thread *
+runqueue_steal(struct cpu *c)
+{
+	struct thread *t, *cold, *hot;
+	unsigned i;
+
+	cold = hot = NULL;
+	for (i = 0; i < SCHED_NLEVELS && cold == NULL; i++) {
+		if (threadlist_isempty(&c->c_runqueue[i])) {
+			continue;
+		}
+		THREADLIST_FORALL(t, c->c_runqueue[i]) {
+			/* see the comment in thread_consider_migration */
+			if (t == c->c_curthread) {
+				continue;
+			}
+			if (sched_ticks - t->t_readysince >=
+			    STEAL_COLD_HARDCLOCKS) {
+				cold = t;
+				break;
+			}
+			if (hot == NULL) {
+				hot = t;
+			}
+		}
+	}
+
+	if (cold != NULL) {
+		t = cold;
+	}
+	else if (hot != NULL && c->c_nrunnable >= STEAL_HOT_MIN) {
+		t = hot;
+	}
+	else {
+		return NULL;
+	}
+	threadlist_remove(&c->c_runqueue[t->t_priority], t);
+	c->c_nrunnable--;
+	return t;
+}
+
+/*
+ * Move a thread from the cpu with the most runnable threads to our own
+ * run queue. Returns true if there was one to take. Called from the
+ * idle loop in thread_switch, with interrupts off and no run queue
+ * lock held; only one run queue lock is held at a time here.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		/*
+		 * Unlocked peek, checked again below. An idle cpu with
+		 * threads queued has been sent an IPI and will run them.
+		 */
+		if (c != curcpu->c_self && !c->c_isidle &&
+		    c->c_nrunnable > most) {
+			victim = c;
+			most = c->c_nrunnable;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = victim->c_isidle ? NULL : runqueue_steal(victim);
+	spinlock_release(&victim->c_runqueue_lock);
+	if (t == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_cpu = curcpu->c_self;
+	runqueue_add(curcpu->c_self, t);
+	curcpu->c_sched_steals++;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return true;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +748,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	target->t_readysince = sched_ticks;
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -492,13 +791,12 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack (thread_checkstack_init is done already) */
+	newthread->t_stack = kmem_cache_alloc(&stack_cache);
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -574,7 +872,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_nrunnable == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -632,10 +930,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+#if OPT_A3 // pre-zeroed pages
+				coremap_idle();
+#endif
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -822,17 +1125,167 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Each cpu has a multilevel feedback queue: SCHED_NLEVELS run queues,
+ * highest priority first, each round-robin. New threads start at level
+ * 0. A thread that runs through its level's time slice (sched_slices)
+ * without blocking moves down a level, so compute-bound threads sink
+ * and get longer slices, while one that wakes up from wchan_sleep moves
+ * up a level. Every SCHED_BOOST_HARDCLOCKS everything goes back to
+ * level 0, so that nothing at the bottom starves. Threads that have
+ * called thread_setpriority stay where they put themselves.
  */
 
+/*
+ * Called from hardclock() every tick, in place of thread_yield: charge
+ * the current thread for the tick, and yield if its slice is used up or
+ * something of higher priority is waiting.
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt;
+
+	if (curcpu->c_number == 0) {
+		sched_ticks++;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+
+	KASSERT(cur->t_slice > 0);
+	if (--cur->t_slice == 0) {
+		if (!cur->t_fixedprio && cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+			curcpu->c_sched_demotions++;
+		}
+		cur->t_slice = sched_slices[cur->t_priority];
+		preempt = true;
+	}
+	else {
+		preempt = runqueue_hashigher(curcpu->c_self, cur->t_priority);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+void
+thread_setpriority(unsigned level)
+{
+	KASSERT(level < SCHED_NLEVELS);
+
+	/* schedule() may look at us from the timer interrupt */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curthread->t_priority = level;
+	curthread->t_slice = sched_slices[level];
+	curthread->t_fixedprio = true;
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Move T, which is on no run queue, up a level on waking up.
+ */
+static
+void
+thread_wakeup_boost(struct thread *t)
+{
+	if (!t->t_fixedprio && t->t_priority > 0) {
+		t->t_priority--;
+		t->t_slice = sched_slices[t->t_priority];
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). Every
+ * SCHED_BOOST_HARDCLOCKS it moves every thread on the current CPU's
+ * run queues, and the current thread, back to level 0, except those
+ * with a fixed priority.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i, n;
+
+	if ((curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i = 1; i < SCHED_NLEVELS; i++) {
+		n = curcpu->c_runqueue[i].tl_count;
+		while (n-- > 0) {
+			t = threadlist_remhead(&curcpu->c_runqueue[i]);
+			if (t->t_fixedprio) {
+				threadlist_addtail(&curcpu->c_runqueue[i], t);
+				continue;
+			}
+			t->t_priority = 0;
+			t->t_slice = sched_slices[0];
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+			curcpu->c_sched_boosts++;
+		}
+	}
+	if (curcpu->c_runqueue[0].tl_count > curcpu->c_sched_maxlen[0]) {
+		curcpu->c_sched_maxlen[0] = curcpu->c_runqueue[0].tl_count;
+	}
+	if (!curcpu->c_isidle && !curthread->t_fixedprio &&
+	    curthread->t_priority > 0) {
+		curthread->t_priority = 0;
+		curthread->t_slice = sched_slices[0];
+		curcpu->c_sched_boosts++;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Print each cpu's run queue lengths (now and at most), how many
+ * threads were taken off each queue and how long they had waited on
+ * average, in hardclocks.
+ */
+void
+schedule_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, j, numcpus;
+	unsigned len[SCHED_NLEVELS], maxlen[SCHED_NLEVELS];
+	unsigned runs[SCHED_NLEVELS];
+	uint64_t waited[SCHED_NLEVELS];
+	unsigned demotions, boosts, steals;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+
+		/* copy it out, so as not to kprintf with the lock held */
+		spinlock_acquire(&c->c_runqueue_lock);
+		for (j = 0; j < SCHED_NLEVELS; j++) {
+			len[j] = c->c_runqueue[j].tl_count;
+			maxlen[j] = c->c_sched_maxlen[j];
+			runs[j] = c->c_sched_runs[j];
+			waited[j] = c->c_sched_waited[j];
+		}
+		demotions = c->c_sched_demotions;
+		boosts = c->c_sched_boosts;
+		steals = c->c_sched_steals;
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u: %u demotions, %u boosts, %u steals\n",
+			c->c_number, demotions, boosts, steals);
+		kprintf("  %5s %6s %6s %9s %9s\n", "level", "queued",
+			"max", "runs", "avg wait");
+		for (j = 0; j < SCHED_NLEVELS; j++) {
+			kprintf("  %5u %6u %6u %9u %9u\n", j, len[j],
+				maxlen[j], runs[j], runs[j] == 0 ? 0 :
+				(unsigned)(waited[j] / runs[j]));
+		}
+	}
 }
 
 /*
@@ -851,6 +1304,9 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * Idle CPUs don't wait for this; they pull work themselves (see
+ * thread_steal).
  */
 void
 thread_consider_migration(void)
@@ -866,9 +1322,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_nrunnable;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_nrunnable;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -882,7 +1338,10 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu->c_self);
+		if (t == NULL) {
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -893,7 +1352,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_nrunnable < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -924,7 +1383,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1407,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -986,6 +1445,17 @@ wchan_create(const char *name)
 	return wc;
 }
 
+/*
+ * Rename a wait channel. It must be empty, so no sleeping thread is
+ * showing the old name in t_wchan_name.
+ */
+void
+wchan_setname(struct wchan *wc, const char *name)
+{
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_name = name;
+}
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  * (The corresponding cleanup functions require this.)
@@ -1050,6 +1520,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	thread_wakeup_boost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1084,6 +1555,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_boost(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1148,7 +1620,8 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n == TLBSHOOTDOWN_MAX || n == TLBSHOOTDOWN_ALL) {
+		/* full, or flushing everything already: stay that way */
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
@@ -1162,6 +1635,19 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_all(struct cpu *target)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+
+	target->c_numshootdown = TLBSHOOTDOWN_ALL;
+
+	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+	mainbus_send_ipi(target);
+
+	spinlock_release(&target->c_ipi_lock);
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <pagecache.h>
+#include "opt-A3.h"
 
 /*
  * Structure for a single named device.
@@ -154,6 +156,11 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+#if OPT_A3
+	/* pages of mapped files go out through the filesystems */
+	/*result =*/ pagecache_flush(NULL);
+#endif
+
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
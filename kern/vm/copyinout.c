@@ -142,12 +142,71 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Word-at-a-time helpers.
+ *
+ * memcpy only copies by words when both pointers and the length are
+ * all word-aligned, and copystr went a byte at a time. Most user
+ * buffers and strings are aligned the same way as the kernel buffer
+ * they go to, so we copy up to a word boundary by bytes, then by
+ * words, then the tail by bytes again.
+ *
+ * Reading a whole aligned word never touches a page the bytes we
+ * want are not on, so it can't fault where a byte copy wouldn't.
+ */
+
+#define WORDMASK	(sizeof(uint32_t) - 1)
+#define ALIGNED(p)	(((uintptr_t)(p) & WORDMASK) == 0)
+
+/* Nonzero if any byte of W is zero. */
+#define HASZERO(w)	(((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
+/*
+ * Copy LEN bytes from SRC to DEST, by words when they are aligned
+ * alike.
+ */
+static
+void
+copywords(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+
+	if (((uintptr_t)d & WORDMASK) != ((uintptr_t)s & WORDMASK)) {
+		memcpy(d, s, len);
+		return;
+	}
+	while (len > 0 && !ALIGNED(s)) {
+		*d++ = *s++;
+		len--;
+	}
+	while (len >= 4 * sizeof(uint32_t)) {
+		((uint32_t *)d)[0] = ((const uint32_t *)s)[0];
+		((uint32_t *)d)[1] = ((const uint32_t *)s)[1];
+		((uint32_t *)d)[2] = ((const uint32_t *)s)[2];
+		((uint32_t *)d)[3] = ((const uint32_t *)s)[3];
+		d += 4 * sizeof(uint32_t);
+		s += 4 * sizeof(uint32_t);
+		len -= 4 * sizeof(uint32_t);
+	}
+	while (len >= sizeof(uint32_t)) {
+		*(uint32_t *)d = *(const uint32_t *)s;
+		d += sizeof(uint32_t);
+		s += sizeof(uint32_t);
+		len -= sizeof(uint32_t);
+	}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC 
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can copy in the ordinary way because it's
+ * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +231,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copywords(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,8 +241,8 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
- * protected by the tm_badfaultfunc/copyfail logic.
+ * user-level address USERDEST. We can copy in the ordinary way because
+ * it's protected by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyout(const void *src, userptr_t userdest, size_t len)
@@ -208,7 +267,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copywords((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -235,9 +294,39 @@ int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, limit;
+	uint32_t w;
+
+	limit = maxlen < stoplen ? maxlen : stoplen;
+	i = 0;
+
+	/* Whole words while the source is aligned and none is a null. */
+	while (i < limit && !ALIGNED(src + i)) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			if (gotlen != NULL) {
+				*gotlen = i+1;
+			}
+			return 0;
+		}
+		i++;
+	}
+	while (i + sizeof(uint32_t) <= limit) {
+		w = *(const uint32_t *)(src + i);
+		if (HASZERO(w)) {
+			break;
+		}
+		if (ALIGNED(dest + i)) {
+			*(uint32_t *)(dest + i) = w;
+		}
+		else {
+			memcpy(dest + i, &w, sizeof(w));
+		}
+		i += sizeof(uint32_t);
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	/* The word with the null in it, or the tail. */
+	for (; i<maxlen && i<stoplen; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
@@ -287,6 +376,58 @@ copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *actual)
 	return result;
 }
 
+/*
+ * copyin_ptrarray
+ *
+ * Copy a null-terminated array of user pointers, such as execv's argv,
+ * from user-level address USERSRC into DEST, which has room for MAX
+ * pointers, in a single guarded pass. The null is copied too. The
+ * number of pointers before it is stored in GOT. Returns E2BIG if
+ * there is no null among the first MAX.
+ */
+int
+copyin_ptrarray(const_userptr_t usersrc, userptr_t *dest, size_t max,
+		size_t *got)
+{
+	const userptr_t *src;
+	int result;
+	size_t stoplen, i, n;
+
+	result = copycheck(usersrc, max * sizeof(userptr_t), &stoplen);
+	if (result) {
+		return result;
+	}
+	n = stoplen / sizeof(userptr_t);
+	src = (const userptr_t *)usersrc;
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	/* Pointers are words; there is no need to look at bytes. */
+	for (i=0; i<n; i++) {
+		if (ALIGNED(src)) {
+			dest[i] = src[i];
+		}
+		else {
+			memcpy(&dest[i], &src[i], sizeof(userptr_t));
+		}
+		if (dest[i] == NULL) {
+			curthread->t_machdep.tm_badfaultfunc = NULL;
+			*got = i;
+			return 0;
+		}
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	/* ran into the kernel, or out of room */
+	return n < max ? EFAULT : E2BIG;
+}
+
 /*
  * copyoutstr
  *
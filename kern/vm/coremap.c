@@ -0,0 +1,877 @@
+/*
+ * Physical page allocator (coremap + buddy free lists).
+ *
+ * The coremap is an array with one entry per managed frame, stored at
+ * the bottom of the memory ram_getsize reports; the frames it manages
+ * start right after it. Frame i lives at coremap_firstaddr + i*PAGE_SIZE.
+ *
+ * Free memory is tracked as blocks of 2^k frames whose index is a
+ * multiple of 2^k. The first entry of each free block is on the free
+ * list for its order. Allocations of a non-power-of-two number of
+ * pages take the smallest block that fits and hand the unused tail
+ * straight back, so nothing is wasted; frees split the run back into
+ * aligned blocks and merge each with its buddy while the buddy is free.
+ *
+ * All of this is protected by coremap_lock.
+ *
+ * In front of the buddy lists, every cpu keeps a small cache of free
+ * single pages in its struct cpu (c_freepages). Single-page allocs
+ * and frees go there first with only interrupts disabled; when the
+ * cache runs dry or overflows, COREMAP_BATCH pages are moved to or
+ * from the buddy lists under a single acquisition of coremap_lock.
+ * Frames sitting in a cpu cache are neither free nor allocated as far
+ * as the buddy lists are concerned (cme_npages 1, cme_refcount 0).
+ *
+ * For paging, a user page mapped by a single page table entry records
+ * that entry as its owner. vm_fault and friends pin a page (cme_busy)
+ * while they use it; the evictor only takes unpinned owned pages, and
+ * keeps the page pinned while it is written out, so anyone else who
+ * wants it waits on coremap_wchan until it has become a swap entry.
+ *
+ * The pagezero thread keeps up to COREMAP_ZEROPOOL allocated frames
+ * that it has already cleared in coremap_zeropool, so zero-fill faults
+ * don't have to. It is woken from the idle loop when the pool runs
+ * low, and clears one page per turn on the cpu. When memory runs out,
+ * the pool is used like any other free memory.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+
+/* Largest block kept on a free list: 2^10 pages = 4MB. */
+#define COREMAP_MAXORDER 10
+
+/* Pages moved between a cpu's cache and the free lists at a time. */
+#define COREMAP_BATCH (CPU_FREEPAGES_MAX / 2)
+
+/* Pre-zeroed frames kept, and the level below which idle cpus refill. */
+#define COREMAP_ZEROPOOL 64
+#define COREMAP_ZEROLOW (COREMAP_ZEROPOOL / 2)
+
+/*
+ * One entry per managed frame.
+ *
+ * cme_refcount is 0 for free frames. For the first frame of an
+ * allocated block it counts the page table entries that map it
+ * (copy-on-write shares single pages); it is 1 for every other
+ * allocated frame. cme_npages is the size of the block that starts
+ * at an allocated frame, or 0 for frames inside a block.
+ *
+ * For the first frame of a free block, cme_free is set, cme_order is
+ * the order of the block, and cme_next/cme_prev link the free list
+ * for that order (-1 terminates).
+ *
+ * cme_pte is the page table entry of the one user page that maps the
+ * frame, or NULL for kernel pages and shared frames, which are never
+ * evicted. cme_referenced is the clock algorithm's use bit.
+ */
+struct coremap_entry {
+	int cme_next;
+	int cme_prev;
+	unsigned cme_npages;
+	unsigned cme_refcount;
+	unsigned char cme_order;
+	bool cme_free;
+	bool cme_busy;
+	bool cme_referenced;
+	struct addrspace *cme_as;
+	vaddr_t cme_vaddr;
+	paddr_t *cme_pte;
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;
+static paddr_t coremap_firstaddr;
+static int coremap_npages;
+static int coremap_freelist[COREMAP_MAXORDER + 1];
+static int coremap_nfree;	/* pages on the free lists */
+static int coremap_hand;	/* clock hand for eviction */
+static struct wchan *coremap_wchan;	/* waiting for a pinned page */
+
+static paddr_t coremap_zeropool[COREMAP_ZEROPOOL];
+static unsigned coremap_nzeroed;
+static bool coremap_zeroer_asleep;
+static struct wchan *coremap_zerowchan;	/* the pagezero thread */
+static unsigned coremap_zero_hits, coremap_zero_misses;
+
+#define COREMAP_INDEX(paddr) ((int)(((paddr) - coremap_firstaddr) / PAGE_SIZE))
+#define COREMAP_PADDR(index) (coremap_firstaddr + (paddr_t)(index) * PAGE_SIZE)
+
+////////////////////////////////////////////////////////////
+// free lists
+
+static
+void
+freelist_push(int index, unsigned order)
+{
+	struct coremap_entry *e = &coremap[index];
+	int head = coremap_freelist[order];
+
+	e->cme_free = true;
+	e->cme_order = order;
+	coremap_nfree += 1 << order;
+	e->cme_prev = -1;
+	e->cme_next = head;
+	if (head >= 0) {
+		coremap[head].cme_prev = index;
+	}
+	coremap_freelist[order] = index;
+}
+
+static
+void
+freelist_remove(int index)
+{
+	struct coremap_entry *e = &coremap[index];
+
+	KASSERT(e->cme_free);
+	coremap_nfree -= 1 << e->cme_order;
+	if (e->cme_prev >= 0) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		coremap_freelist[e->cme_order] = e->cme_next;
+	}
+	if (e->cme_next >= 0) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	e->cme_free = false;
+	e->cme_next = e->cme_prev = -1;
+}
+
+/*
+ * Free the aligned block of 2^ORDER frames at INDEX, merging it with
+ * its buddy for as long as the buddy is a free block of the same order.
+ */
+static
+void
+buddy_free(int index, unsigned order)
+{
+	int buddy;
+
+	while (order < COREMAP_MAXORDER) {
+		buddy = index ^ (1 << order);
+		if (buddy >= coremap_npages ||
+		    !coremap[buddy].cme_free ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < index) {
+			index = buddy;
+		}
+		order++;
+	}
+	freelist_push(index, order);
+}
+
+/*
+ * Free NPAGES frames starting at INDEX, which need not be a power of
+ * two or aligned, as a sequence of maximal aligned blocks.
+ */
+static
+void
+coremap_free_range(int index, unsigned long npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < COREMAP_MAXORDER &&
+		       (index & (1 << order)) == 0 &&
+		       (2UL << order) <= npages) {
+			order++;
+		}
+		buddy_free(index, order);
+		index += 1 << order;
+		npages -= 1UL << order;
+	}
+}
+
+/*
+ * Take an aligned block of 2^ORDER frames off the free lists,
+ * splitting a larger one if need be. Returns -1 if there is none.
+ */
+static
+int
+buddy_alloc(unsigned order)
+{
+	unsigned o;
+	int index;
+
+	for (o = order; o <= COREMAP_MAXORDER; o++) {
+		if (coremap_freelist[o] >= 0) {
+			break;
+		}
+	}
+	if (o > COREMAP_MAXORDER) {
+		return -1;
+	}
+
+	index = coremap_freelist[o];
+	freelist_remove(index);
+
+	/* Split off the upper halves until the block is the right order. */
+	while (o > order) {
+		o--;
+		freelist_push(index + (1 << o), o);
+	}
+	return index;
+}
+
+////////////////////////////////////////////////////////////
+// per-cpu page caches
+//
+// These run with interrupts off, which keeps us on the same cpu.
+
+/*
+ * Move up to COREMAP_BATCH single pages from the free lists into
+ * cpu C's cache.
+ */
+static
+void
+pcpu_refill(struct cpu *c)
+{
+	int index;
+
+	spinlock_acquire(&coremap_lock);
+	while (c->c_nfreepages < COREMAP_BATCH) {
+		index = buddy_alloc(0);
+		if (index < 0) {
+			break;
+		}
+		coremap[index].cme_npages = 1;
+		c->c_freepages[c->c_nfreepages++] = COREMAP_PADDR(index);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Give up to NPAGES pages from cpu C's cache back to the free lists.
+ */
+static
+void
+pcpu_drain(struct cpu *c, unsigned npages)
+{
+	int index;
+
+	spinlock_acquire(&coremap_lock);
+	while (npages > 0 && c->c_nfreepages > 0) {
+		index = COREMAP_INDEX(c->c_freepages[--c->c_nfreepages]);
+		coremap[index].cme_npages = 0;
+		buddy_free(index, 0);
+		npages--;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+static
+paddr_t
+pcpu_alloc(void)
+{
+	struct cpu *c;
+	paddr_t paddr;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+
+	if (c->c_nfreepages > 0) {
+		c->c_freepage_hits++;
+	}
+	else {
+		c->c_freepage_misses++;
+		pcpu_refill(c);
+		if (c->c_nfreepages == 0) {
+			splx(spl);
+			return 0;
+		}
+	}
+
+	paddr = c->c_freepages[--c->c_nfreepages];
+	/* the frame is this cpu's alone; no need for the lock */
+	coremap[COREMAP_INDEX(paddr)].cme_refcount = 1;
+
+	splx(spl);
+	return paddr;
+}
+
+static
+void
+pcpu_free(paddr_t paddr)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+
+	coremap[COREMAP_INDEX(paddr)].cme_refcount = 0;
+	coremap[COREMAP_INDEX(paddr)].cme_pte = NULL;
+	coremap[COREMAP_INDEX(paddr)].cme_busy = false;
+	if (c->c_nfreepages == CPU_FREEPAGES_MAX) {
+		c->c_freepage_drains++;
+		pcpu_drain(c, COREMAP_BATCH);
+	}
+	c->c_freepages[c->c_nfreepages++] = paddr;
+
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// pre-zeroed pages
+
+/*
+ * Take a frame out of the zero pool. Returns 0 if it is empty.
+ */
+static
+paddr_t
+zeropool_take(void)
+{
+	paddr_t paddr = 0;
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nzeroed > 0) {
+		paddr = coremap_zeropool[--coremap_nzeroed];
+	}
+	spinlock_release(&coremap_lock);
+
+	return paddr;
+}
+
+/*
+ * Give every frame in the zero pool back to the free lists.
+ */
+static
+void
+zeropool_drain(void)
+{
+	int index;
+
+	spinlock_acquire(&coremap_lock);
+	while (coremap_nzeroed > 0) {
+		index = COREMAP_INDEX(coremap_zeropool[--coremap_nzeroed]);
+		coremap[index].cme_npages = 0;
+		coremap[index].cme_refcount = 0;
+		buddy_free(index, 0);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_reclaim(void)
+{
+	unsigned n;
+	int spl;
+
+	spl = splhigh();
+	n = curcpu->c_nfreepages;
+	pcpu_drain(curcpu->c_self, CPU_FREEPAGES_MAX);
+	splx(spl);
+
+	spinlock_acquire(&coremap_lock);
+	n += coremap_nzeroed;
+	spinlock_release(&coremap_lock);
+	zeropool_drain();
+
+	return n;
+}
+
+/*
+ * The pagezero thread: fill the pool one page at a time from the lowest
+ * run queue, so that anything else runnable goes first, yielding between
+ * pages, and sleep once it is full (or memory is short) until an idle
+ * cpu wakes us.
+ */
+static
+void
+zeropool_thread(void *data1, unsigned long data2)
+{
+	paddr_t paddr;
+	bool full;
+
+	(void)data1;
+	(void)data2;
+
+	thread_setpriority(SCHED_NLEVELS - 1);
+
+	while (1) {
+		paddr = 0;
+		spinlock_acquire(&coremap_lock);
+		full = coremap_nzeroed >= COREMAP_ZEROPOOL;
+		spinlock_release(&coremap_lock);
+		if (!full) {
+			paddr = pcpu_alloc();
+		}
+
+		if (paddr == 0) {
+			spinlock_acquire(&coremap_lock);
+			coremap_zeroer_asleep = true;
+			wchan_lock(coremap_zerowchan);
+			spinlock_release(&coremap_lock);
+			wchan_sleep(coremap_zerowchan);
+			continue;
+		}
+
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+		spinlock_acquire(&coremap_lock);
+		if (coremap_nzeroed < COREMAP_ZEROPOOL) {
+			coremap_zeropool[coremap_nzeroed++] = paddr;
+			paddr = 0;
+		}
+		spinlock_release(&coremap_lock);
+		if (paddr != 0) {
+			coremap_free(paddr);
+		}
+
+		thread_yield();
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t first, last;
+	int total_pages, coremap_pages, i;
+
+	ram_getsize(&first, &last);
+
+	total_pages = (last - first) / PAGE_SIZE;
+	coremap_pages = DIVROUNDUP(total_pages * sizeof(struct coremap_entry),
+				   PAGE_SIZE);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(first);
+	coremap_firstaddr = first + coremap_pages * PAGE_SIZE;
+	coremap_npages = total_pages - coremap_pages;
+
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		coremap_freelist[i] = -1;
+	}
+	for (i = 0; i < coremap_npages; i++) {
+		coremap[i].cme_next = -1;
+		coremap[i].cme_prev = -1;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_free = false;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_referenced = false;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_pte = NULL;
+	}
+
+	coremap_free_range(0, coremap_npages);
+}
+
+void
+coremap_pin_bootstrap(void)
+{
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("coremap_pin_bootstrap: Out of memory\n");
+	}
+}
+
+void
+coremap_zero_bootstrap(void)
+{
+	int result;
+
+	coremap_zerowchan = wchan_create("pagezero");
+	if (coremap_zerowchan == NULL) {
+		panic("coremap_zero_bootstrap: Out of memory\n");
+	}
+	result = thread_fork("pagezero", NULL, zeropool_thread, NULL, 0);
+	if (result) {
+		panic("coremap_zero_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+paddr_t
+coremap_alloc_zeroed(void)
+{
+	paddr_t paddr = 0;
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nzeroed > 0) {
+		paddr = coremap_zeropool[--coremap_nzeroed];
+		coremap_zero_hits++;
+	}
+	else {
+		coremap_zero_misses++;
+	}
+	spinlock_release(&coremap_lock);
+
+	return paddr;
+}
+
+void
+coremap_idle(void)
+{
+	bool wake;
+
+	/* unlocked peek; this runs on every trip round the idle loop */
+	if (!coremap_zeroer_asleep || coremap_nzeroed >= COREMAP_ZEROLOW) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	wake = coremap_zeroer_asleep && coremap_nzeroed < COREMAP_ZEROLOW;
+	if (wake) {
+		coremap_zeroer_asleep = false;
+	}
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		wchan_wakeone(coremap_zerowchan);
+	}
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	paddr_t paddr;
+	unsigned want;
+	int index, i, spl;
+
+	KASSERT(npages > 0);
+
+	if (npages == 1) {
+		paddr = pcpu_alloc();
+		if (paddr == 0) {
+			/* last resort: zeroed pages are free pages too */
+			paddr = zeropool_take();
+		}
+		return paddr;
+	}
+
+	want = 0;
+	while ((1UL << want) < npages) {
+		want++;
+	}
+	if (want > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	spl = splhigh();
+	spinlock_acquire(&coremap_lock);
+	index = buddy_alloc(want);
+	if (index < 0) {
+		/* Pages in our own cache might be what's missing. */
+		spinlock_release(&coremap_lock);
+		pcpu_drain(curcpu->c_self, CPU_FREEPAGES_MAX);
+		zeropool_drain();
+		spinlock_acquire(&coremap_lock);
+		index = buddy_alloc(want);
+	}
+	if (index < 0) {
+		spinlock_release(&coremap_lock);
+		splx(spl);
+		return 0;
+	}
+
+	/* Give back the pages past NPAGES in a 2^want block. */
+	if ((1UL << want) > npages) {
+		coremap_free_range(index + npages, (1UL << want) - npages);
+	}
+
+	for (i = 0; i < (int)npages; i++) {
+		coremap[index + i].cme_npages = 0;
+		coremap[index + i].cme_refcount = 1;
+	}
+	coremap[index].cme_npages = npages;
+
+	spinlock_release(&coremap_lock);
+	splx(spl);
+
+	return COREMAP_PADDR(index);
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	int index;
+	unsigned npages, i;
+	bool wake;
+
+	if (paddr < coremap_firstaddr) {
+		/* stolen before vm_bootstrap - leak it */
+		return;
+	}
+
+	index = COREMAP_INDEX(paddr);
+	KASSERT(index < coremap_npages);
+	KASSERT(coremap[index].cme_npages > 0);
+	KASSERT(coremap[index].cme_refcount > 0);
+
+	/*
+	 * A reference count of 1 can only be changed by its holder,
+	 * which is us, so it is safe to look at without the lock. If
+	 * the page is pinned, we are the ones who pinned it (the
+	 * evictor never frees), and nobody else can be waiting for it.
+	 */
+	if (coremap[index].cme_npages == 1 &&
+	    coremap[index].cme_refcount == 1) {
+		pcpu_free(paddr);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	npages = coremap[index].cme_npages;
+	wake = coremap[index].cme_busy;
+	coremap[index].cme_busy = false;
+
+	/* copy-on-write: someone else still maps this frame */
+	coremap[index].cme_refcount--;
+	if (coremap[index].cme_refcount > 0) {
+		spinlock_release(&coremap_lock);
+		if (wake) {
+			wchan_wakeall(coremap_wchan);
+		}
+		return;
+	}
+
+	for (i = 0; i < npages; i++) {
+		coremap[index + i].cme_npages = 0;
+		coremap[index + i].cme_refcount = 0;
+	}
+	coremap[index].cme_pte = NULL;
+	coremap_free_range(index, npages);
+
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_share(paddr_t paddr)
+{
+	int index = COREMAP_INDEX(paddr);
+
+	KASSERT(paddr >= coremap_firstaddr && index < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[index].cme_npages == 1);
+	KASSERT(coremap[index].cme_refcount > 0);
+	coremap[index].cme_refcount++;
+	/* shared frames have no single owner and are not evicted */
+	coremap[index].cme_pte = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_is_shared(paddr_t paddr)
+{
+	int index = COREMAP_INDEX(paddr);
+
+	KASSERT(paddr >= coremap_firstaddr && index < coremap_npages);
+
+	/*
+	 * No lock: if we see 1 we are the only holder and nobody else
+	 * can change it. If we see more, the answer may be stale by the
+	 * time we act on it, which only costs an unneeded copy.
+	 */
+	return coremap[index].cme_refcount > 1;
+}
+
+paddr_t
+coremap_pin(paddr_t *pte, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *e;
+	paddr_t entry;
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		entry = *pte;
+		if (!PTE_ISRESIDENT(entry)) {
+			break;
+		}
+
+		e = &coremap[COREMAP_INDEX(PTE_FRAME(entry))];
+		if (!e->cme_busy) {
+			e->cme_busy = true;
+			e->cme_referenced = true;
+			if (as != NULL && e->cme_refcount == 1) {
+				e->cme_as = as;
+				e->cme_vaddr = vaddr;
+				e->cme_pte = pte;
+			}
+			break;
+		}
+
+		/* being evicted (or pinned by a sharer); *pte may change */
+		wchan_lock(coremap_wchan);
+		spinlock_release(&coremap_lock);
+		wchan_sleep(coremap_wchan);
+		spinlock_acquire(&coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+
+	return entry;
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	int index = COREMAP_INDEX(paddr);
+
+	KASSERT(paddr >= coremap_firstaddr && index < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[index].cme_busy);
+	coremap[index].cme_busy = false;
+	spinlock_release(&coremap_lock);
+
+	wchan_wakeall(coremap_wchan);
+}
+
+paddr_t
+coremap_prefetch(paddr_t *pte)
+{
+	paddr_t entry;
+
+	/* under the lock, so coremap_victim can't clear the bits under us */
+	spinlock_acquire(&coremap_lock);
+	entry = *pte;
+	if ((entry & PTE_VALID) == 0 || !PTE_ISRESIDENT(entry) ||
+	    (entry & (PTE_TLBVALID | PTE_PREFETCH)) == 0 ||
+	    coremap[COREMAP_INDEX(PTE_FRAME(entry))].cme_busy) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	*pte = (entry & ~PTE_TLBVALID) | PTE_PREFETCH;
+	spinlock_release(&coremap_lock);
+
+	return entry;
+}
+
+paddr_t
+coremap_victim(struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *e;
+	int n, index;
+
+	spinlock_acquire(&coremap_lock);
+
+	/* two passes: the first may only be clearing use bits */
+	for (n = 0; n < 2 * coremap_npages; n++) {
+		index = coremap_hand;
+		coremap_hand = (coremap_hand + 1) % coremap_npages;
+
+		e = &coremap[index];
+		if (e->cme_pte == NULL || e->cme_busy ||
+		    e->cme_refcount != 1) {
+			continue;
+		}
+		/*
+		 * Refills by the fast path in exception-mips1.S don't set
+		 * the use bit, so clearing it sends the next TLB miss on
+		 * the page through vm_fault, which does.
+		 */
+		*e->cme_pte &= ~PTE_TLBBITS;
+		if (e->cme_referenced) {
+			/* second chance */
+			e->cme_referenced = false;
+			continue;
+		}
+
+		e->cme_busy = true;
+		*as = e->cme_as;
+		*vaddr = e->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return COREMAP_PADDR(index);
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+void
+coremap_evicted(paddr_t paddr, paddr_t pte)
+{
+	int index = COREMAP_INDEX(paddr);
+	struct coremap_entry *e = &coremap[index];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(e->cme_busy && e->cme_pte != NULL);
+	KASSERT(e->cme_npages == 1 && e->cme_refcount == 1);
+
+	*e->cme_pte = (*e->cme_pte & PTE_PERMS) | pte;
+	e->cme_pte = NULL;
+	e->cme_as = NULL;
+	e->cme_busy = false;
+	e->cme_npages = 0;
+	e->cme_refcount = 0;
+
+	/*
+	 * Straight to the free lists rather than a cpu cache, so that
+	 * the clock sweeping through neighbouring frames can build up
+	 * the contiguous blocks multi-page allocations need.
+	 */
+	buddy_free(index, 0);
+	spinlock_release(&coremap_lock);
+
+	wchan_wakeall(coremap_wchan);
+}
+
+unsigned
+coremap_inuse(void)
+{
+	struct cpu *c;
+	unsigned i, n, free;
+
+	spinlock_acquire(&coremap_lock);
+	free = coremap_nfree + coremap_nzeroed;
+	spinlock_release(&coremap_lock);
+
+	/* cpu caches change under us; this is only a snapshot anyway */
+	n = cpu_numcpus();
+	for (i = 0; i < n; i++) {
+		c = cpu_getbynumber(i);
+		free += c->c_nfreepages;
+	}
+	return free < (unsigned)coremap_npages ? coremap_npages - free : 0;
+}
+
+void
+coremap_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, n, hits, misses, cached;
+
+	cached = 0;
+	n = cpu_numcpus();
+	for (i = 0; i < n; i++) {
+		c = cpu_getbynumber(i);
+		hits = c->c_freepage_hits;
+		misses = c->c_freepage_misses;
+		cached += c->c_nfreepages;
+		kprintf("cpu%u page cache: %u hits, %u misses (%u%% hit rate), "
+			"%u drains, %u pages cached\n",
+			i, hits, misses,
+			hits + misses == 0 ? 0 : hits * 100 / (hits + misses),
+			c->c_freepage_drains, c->c_nfreepages);
+	}
+	kprintf("coremap: %d pages, %d on free lists, %u in cpu caches\n",
+		coremap_npages, coremap_nfree, cached);
+	hits = coremap_zero_hits;
+	misses = coremap_zero_misses;
+	kprintf("zero pool: %u hits, %u misses (%u%% hit rate), "
+		"%u pages zeroed\n", hits, misses,
+		hits + misses == 0 ? 0 : hits * 100 / (hits + misses),
+		coremap_nzeroed);
+}
@@ -70,10 +70,15 @@ fill_deadbeef(void *vptr, size_t len)
 //    more blocks would fit on a page than with the existing block
 //    sizes, and large numbers of items of the new size are allocated.
 //
-//    The free counts and addresses of the pages are maintained in
-//    another list.  Maintaining this table is a nuisance, because it
-//    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    Blocks bigger than half a page come from spans of several pages
+//    instead, so that objects of a page and a half, say, don't take
+//    two. Below, "page" means the span for those sizes.
+//
+//    The free counts and addresses of the pages are kept in pageref
+//    structures, which are found from a page address through a hash
+//    table. Pagerefs cannot recursively use the subpage allocator, so
+//    they are carved out of whole pages of their own, taken from
+//    alloc_kpages as needed.
 //
 
 #undef  SLOW	/* consistency checks */
@@ -83,11 +88,15 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES 10
+static const size_t sizes[NSIZES] =
+	{ 16, 32, 64, 128, 256, 512, 1024, 2048, 3072, 6144 };
+/* pages per span: four 3K or two 6K blocks fit three pages exactly */
+static const unsigned spanpages[NSIZES] = { 1, 1, 1, 1, 1, 1, 1, 1, 3, 3 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 6144
+#define MAX_SPANPAGES 3
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -95,6 +104,9 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+#define SPANSIZE(blktype) (spanpages[blktype] * PAGE_SIZE)
+#define NBLOCKS(blktype)  (SPANSIZE(blktype) / sizes[blktype])
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -102,8 +114,8 @@ struct freelist {
 };
 
 struct pageref {
-	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *next_samesize;	/* also the pageref free list */
+	struct pageref *next_hash;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -118,73 +130,112 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
+ * Pagerefs come a page at a time from alloc_kpages, and unused ones
+ * are kept on a free list. Pages of pagerefs are never given back;
+ * they are 1/256 of the heap they describe at most.
  *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * The pagerefs in use are hashed on their page address, so that kfree
+ * can find the page a block belongs to without walking every page.
+ * One page of buckets keeps the chains short up to a few megabytes of
+ * subpage heap.
  */
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+#define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
+
+#define PRHASH_SIZE (PAGE_SIZE / sizeof(struct pageref *))
+#define PRHASH(va) (((va) / PAGE_SIZE) % PRHASH_SIZE)
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static unsigned npagerefs;	/* total, free or not */
+static struct pageref *pagerefhash[PRHASH_SIZE];
 
+/*
+ * Returns NULL if no pageref is free; call morepagerefs and try again.
+ */
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
+	struct pageref *pr;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
+	pr = freepagerefs;
+	if (pr != NULL) {
+		freepagerefs = pr->next_samesize;
 	}
+	return pr;
+}
 
-	/* ran out */
-	return NULL;
+static
+void
+freepageref(struct pageref *pr)
+{
+	pr->next_samesize = freepagerefs;
+	freepagerefs = pr;
 }
 
+/*
+ * Add the page at PRPAGE to the free pagerefs.
+ */
 static
 void
-freepageref(struct pageref *p)
+morepagerefs(vaddr_t prpage)
 {
-	size_t i, j;
-	uint32_t k;
-
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	struct pageref *prs = (struct pageref *)prpage;
+	unsigned i;
+
+	for (i=0; i<NPAGEREFS_PER_PAGE; i++) {
+		freepageref(&prs[i]);
+	}
+	npagerefs += NPAGEREFS_PER_PAGE;
+}
+
+/*
+ * Find the pageref for the page containing PTRADDR, or NULL if that
+ * is not a subpage page. A span may start up to MAX_SPANPAGES-1 pages
+ * before the page PTRADDR is in; the first span found going back is
+ * the only one that can hold it, as spans don't overlap.
+ */
+static
+struct pageref *
+findpageref(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+	unsigned k;
+
+	for (k=0; k<MAX_SPANPAGES; k++) {
+		prpage = (ptraddr & PAGE_FRAME) - k*PAGE_SIZE;
+		for (pr = pagerefhash[PRHASH(prpage)]; pr; pr = pr->next_hash) {
+			if (PR_PAGEADDR(pr) == prpage) {
+				if (ptraddr - prpage < SPANSIZE(PR_BLOCKTYPE(pr))) {
+					return pr;
+				}
+				return NULL;
+			}
+		}
+	}
+	return NULL;
 }
 
 ////////////////////////////////////////
 
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+/*
+ * Counters for kheap_printstats. Blocks round requests up, and
+ * ks_requested adds up what was actually asked for, so comparing it
+ * with ks_allocs blocks gives the space lost inside blocks. For the
+ * whole-page allocations in largestats, ks_pages counts every page
+ * handed out, as kfree does not know how many it is giving back.
+ */
+struct kheap_stats {
+	unsigned ks_allocs;
+	unsigned ks_frees;
+	unsigned ks_pages;		/* pages held (see above) */
+	uint64_t ks_requested;		/* bytes asked for */
+};
+static struct kheap_stats sizestats[NSIZES];
+static struct kheap_stats largestats;
 
 ////////////////////////////////////////
 
@@ -226,7 +277,7 @@ checksubpage(struct pageref *pr)
 	prpage = PR_PAGEADDR(pr);
 	blktype = PR_BLOCKTYPE(pr);
 
-	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	KASSERT(pr->freelist_offset < SPANSIZE(blktype));
 	KASSERT(pr->freelist_offset % sizes[blktype] == 0);
 
 	fla = prpage + pr->freelist_offset;
@@ -234,7 +285,7 @@ checksubpage(struct pageref *pr)
 
 	for (; fl != NULL; fl = fl->next) {
 		fla = (vaddr_t)fl;
-		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
+		KASSERT(fla >= prpage && fla < prpage + SPANSIZE(blktype));
 		KASSERT((fla-prpage) % sizes[blktype] == 0);
 		KASSERT(fla >= MIPS_KSEG0);
 		KASSERT(fla < MIPS_KSEG1);
@@ -260,15 +311,18 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < npagerefs);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
-		ac++;
+	for (i=0; i<(int)PRHASH_SIZE; i++) {
+		for (pr = pagerefhash[i]; pr != NULL; pr = pr->next_hash) {
+			checksubpage(pr);
+			KASSERT(PRHASH(PR_PAGEADDR(pr)) == (unsigned)i);
+			KASSERT(ac < npagerefs);
+			ac++;
+		}
 	}
 
 	KASSERT(sc==ac);
@@ -301,7 +355,7 @@ dumpsubpage(struct pageref *pr)
 	blktype = PR_BLOCKTYPE(pr);
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = NBLOCKS(blktype);
 	KASSERT(n <= 32*sizeof(freemap)/sizeof(freemap[0]));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
@@ -330,21 +384,76 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Percentage of A in B, 0 if B is.
+ */
+static
+unsigned
+percent(uint64_t a, uint64_t b)
+{
+	return b == 0 ? 0 : (unsigned)(a * 100 / b);
+}
+
+/*
+ * Print the counters for each size. "in use" is in blocks, "free" is
+ * the part of the held pages not in use, and "lost" the part of the
+ * blocks ever allocated that was not asked for.
+ */
+static
+void
+kheap_printsizes(void)
+{
+	struct kheap_stats ss[NSIZES], ls;
+	unsigned i, inuse, held;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<NSIZES; i++) {
+		ss[i] = sizestats[i];
+	}
+	ls = largestats;
+	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("Size classes:\n");
+	kprintf("   %5s %9s %9s %7s %9s %6s %5s %5s\n", "size", "allocs",
+		"frees", "in use", "bytes", "pages", "free", "lost");
+	for (i=0; i<NSIZES; i++) {
+		inuse = ss[i].ks_allocs - ss[i].ks_frees;
+		held = ss[i].ks_pages / spanpages[i] * NBLOCKS(i);
+		kprintf("   %5lu %9u %9u %7u %9lu %6u %4u%% %4u%%\n",
+			(unsigned long)sizes[i], ss[i].ks_allocs,
+			ss[i].ks_frees, inuse,
+			(unsigned long)(inuse * sizes[i]), ss[i].ks_pages,
+			percent(held - inuse, held),
+			percent((uint64_t)ss[i].ks_allocs * sizes[i]
+				- ss[i].ks_requested,
+				(uint64_t)ss[i].ks_allocs * sizes[i]));
+	}
+	kprintf("   pages %9u %9u %7s %9s %6u %5s %4u%%\n",
+		ls.ks_allocs, ls.ks_frees, "-", "-", ls.ks_pages, "-",
+		percent((uint64_t)ls.ks_pages * PAGE_SIZE - ls.ks_requested,
+			(uint64_t)ls.ks_pages * PAGE_SIZE));
+}
+
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	for (i=0; i<PRHASH_SIZE; i++) {
+		for (pr = pagerefhash[i]; pr != NULL; pr = pr->next_hash) {
+			dumpsubpage(pr);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kheap_printsizes();
 }
 
 ////////////////////////////////////////
@@ -365,10 +474,11 @@ remove_lists(struct pageref *pr, int blktype)
 		}
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
+	guy = &pagerefhash[PRHASH(PR_PAGEADDR(pr))];
+	for (; *guy; guy = &(*guy)->next_hash) {
 		checksubpage(*guy);
 		if (*guy == pr) {
-			*guy = pr->next_all;
+			*guy = pr->next_hash;
 			break;
 		}
 	}
@@ -397,8 +507,10 @@ void *
 subpage_kmalloc(size_t sz)
 {
 	unsigned blktype;	// index into sizes[] that we're using
+	size_t reqsz;		// the size asked for
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t prrefs;		// a new page of pagerefs
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
@@ -407,6 +519,7 @@ subpage_kmalloc(size_t sz)
 
 
 	blktype = blocktype(sz);
+	reqsz = sz;
 	sz = sizes[blktype];
 
 	spinlock_acquire(&kmalloc_spinlock);
@@ -423,7 +536,7 @@ subpage_kmalloc(size_t sz)
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
+			KASSERT(pr->freelist_offset < SPANSIZE(blktype));
 			prpage = PR_PAGEADDR(pr);
 			fla = prpage + pr->freelist_offset;
 			fl = (struct freelist *)fla;
@@ -435,7 +548,7 @@ subpage_kmalloc(size_t sz)
 			if (fl != NULL) {
 				KASSERT(pr->nfree > 0);
 				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
+				KASSERT(fla - prpage < SPANSIZE(blktype));
 				pr->freelist_offset = fla - prpage;
 			}
 			else {
@@ -443,6 +556,9 @@ subpage_kmalloc(size_t sz)
 				pr->freelist_offset = INVALID_OFFSET;
 			}
 
+			sizestats[blktype].ks_allocs++;
+			sizestats[blktype].ks_requested += reqsz;
+
 			checksubpages();
 
 			spinlock_release(&kmalloc_spinlock);
@@ -460,7 +576,7 @@ subpage_kmalloc(size_t sz)
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = alloc_kpages(spanpages[blktype]);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
@@ -470,15 +586,28 @@ subpage_kmalloc(size_t sz)
 
 	pr = allocpageref();
 	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+		/*
+		 * Get another page of pagerefs. As above, things can
+		 * change while the lock is dropped; if someone else added
+		 * pagerefs in the meantime, we just have more.
+		 */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		prrefs = alloc_kpages(1);
+		if (prrefs==0) {
+			/* Couldn't allocate accounting space for the new page. */
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+			return NULL;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		morepagerefs(prrefs);
+		pr = allocpageref();
+		KASSERT(pr != NULL);
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->nfree = NBLOCKS(blktype);
+	sizestats[blktype].ks_pages += spanpages[blktype];
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -501,8 +630,8 @@ subpage_kmalloc(size_t sz)
 	pr->next_samesize = sizebases[blktype];
 	sizebases[blktype] = pr;
 
-	pr->next_all = allbase;
-	allbase = pr;
+	pr->next_hash = pagerefhash[PRHASH(prpage)];
+	pagerefhash[PRHASH(prpage)] = pr;
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -526,29 +655,24 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if (offset >= SPANSIZE(blktype) || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -572,10 +696,12 @@ subpage_kfree(void *ptr)
 	}
 	pr->freelist_offset = offset;
 	pr->nfree++;
+	sizestats[blktype].ks_frees++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+	KASSERT(pr->nfree <= NBLOCKS(blktype));
+	if (pr->nfree == NBLOCKS(blktype)) {
 		/* Whole page is free. */
+		sizestats[blktype].ks_pages -= spanpages[blktype];
 		remove_lists(pr, blktype);
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
@@ -601,21 +727,30 @@ subpage_kfree(void *ptr)
 void *
 kmalloc(size_t sz)
 {
-	if (sz>=LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
-
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
-		}
+	unsigned long npages;
+	vaddr_t address;
+
+	/* Round up to a whole number of pages. */
+	npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 
-		return (void *)address;
+	/* Blocks where they take less space than the pages would. */
+	if (sz == 0 || (sz <= LARGEST_SUBPAGE_SIZE &&
+			sizes[blocktype(sz)] < npages * PAGE_SIZE)) {
+		return subpage_kmalloc(sz);
+	}
+
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
 	}
 
-	return subpage_kmalloc(sz);
+	spinlock_acquire(&kmalloc_spinlock);
+	largestats.ks_allocs++;
+	largestats.ks_pages += npages;
+	largestats.ks_requested += sz;
+	spinlock_release(&kmalloc_spinlock);
+
+	return (void *)address;
 }
 
 void
@@ -628,7 +763,9 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+		spinlock_acquire(&kmalloc_spinlock);
+		largestats.ks_frees++;
+		spinlock_release(&kmalloc_spinlock);
 		free_kpages((vaddr_t)ptr);
 	}
 }
-
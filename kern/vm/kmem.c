@@ -0,0 +1,234 @@
+/*
+ * Object caches (see kmem.h).
+ *
+ * The per-cpu magazines are only touched by their own cpu with
+ * interrupts off, which also keeps us from moving to another cpu
+ * halfway through. The depot and the statistics that are not per cpu
+ * are protected by the cache's kc_lock. kmalloc and the constructor
+ * and destructor are never called with either held.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <kmem.h>
+
+/* every cache that has been used, for kmem_reap and kmem_printstats */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+kmem_register(struct kmem_cache *kc)
+{
+	spinlock_acquire(&kmem_lock);
+	if (!kc->kc_listed) {
+		kc->kc_listed = true;
+		kc->kc_next = kmem_caches;
+		kmem_caches = kc;
+	}
+	spinlock_release(&kmem_lock);
+}
+
+/*
+ * Give OBJ's memory back to kmalloc.
+ */
+static
+void
+kmem_destroy(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_cpu *cc;
+	struct kmem_magazine *m;
+	void *obj;
+	int spl;
+
+	if (CURCPU_EXISTS()) {
+		spl = splhigh();
+		cc = &kc->kc_cpu[curcpu->c_number];
+		m = cc->kcc_loaded;
+
+		/* trade an empty magazine for a full one */
+		if (m == NULL || m->km_nrounds == 0) {
+			spinlock_acquire(&kc->kc_lock);
+			if (kc->kc_full != NULL) {
+				if (m != NULL) {
+					m->km_next = kc->kc_empty;
+					kc->kc_empty = m;
+				}
+				m = kc->kc_full;
+				kc->kc_full = m->km_next;
+				kc->kc_nfull--;
+				cc->kcc_loaded = m;
+			}
+			spinlock_release(&kc->kc_lock);
+		}
+
+		if (m != NULL && m->km_nrounds > 0) {
+			obj = m->km_rounds[--m->km_nrounds];
+			cc->kcc_hits++;
+			splx(spl);
+			return obj;
+		}
+		cc->kcc_misses++;
+		splx(spl);
+	}
+
+	if (!kc->kc_listed) {
+		kmem_register(kc);
+	}
+
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj)) {
+		kfree(obj);
+		return NULL;
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_cpu *cc;
+	struct kmem_magazine *m;
+	unsigned tries;
+	int spl;
+
+	KASSERT(obj != NULL);
+
+	for (tries = 0; CURCPU_EXISTS() && tries < 2; tries++) {
+		spl = splhigh();
+		cc = &kc->kc_cpu[curcpu->c_number];
+		m = cc->kcc_loaded;
+
+		/* trade a full magazine for an empty one, if the depot has room */
+		if (m == NULL || m->km_nrounds == KMEM_MAGSIZE) {
+			spinlock_acquire(&kc->kc_lock);
+			if (kc->kc_empty != NULL &&
+			    (m == NULL || kc->kc_nfull < kc->kc_depotmax)) {
+				if (m != NULL) {
+					m->km_next = kc->kc_full;
+					kc->kc_full = m;
+					kc->kc_nfull++;
+				}
+				m = kc->kc_empty;
+				kc->kc_empty = m->km_next;
+				cc->kcc_loaded = m;
+			}
+			spinlock_release(&kc->kc_lock);
+		}
+
+		if (m != NULL && m->km_nrounds < KMEM_MAGSIZE) {
+			m->km_rounds[m->km_nrounds++] = obj;
+			splx(spl);
+			return;
+		}
+		splx(spl);
+
+		/* no empty magazine: make one, unless the depot is full */
+		if (m != NULL && kc->kc_nfull >= kc->kc_depotmax) {
+			break;
+		}
+		m = kmalloc(sizeof(struct kmem_magazine));
+		if (m == NULL) {
+			break;
+		}
+		m->km_nrounds = 0;
+		spinlock_acquire(&kc->kc_lock);
+		m->km_next = kc->kc_empty;
+		kc->kc_empty = m;
+		spinlock_release(&kc->kc_lock);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_destroyed++;
+	spinlock_release(&kc->kc_lock);
+	kmem_destroy(kc, obj);
+}
+
+/*
+ * Destroy the objects in KC's depot and free its magazines. The cpus'
+ * own magazines are left alone.
+ */
+static
+void
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	struct kmem_magazine *full, *empty, *m;
+	unsigned i;
+
+	spinlock_acquire(&kc->kc_lock);
+	full = kc->kc_full;
+	empty = kc->kc_empty;
+	kc->kc_full = kc->kc_empty = NULL;
+	kc->kc_nfull = 0;
+	spinlock_release(&kc->kc_lock);
+
+	while ((m = full) != NULL) {
+		full = m->km_next;
+		for (i = 0; i < m->km_nrounds; i++) {
+			kmem_destroy(kc, m->km_rounds[i]);
+		}
+		kfree(m);
+	}
+	while ((m = empty) != NULL) {
+		empty = m->km_next;
+		kfree(m);
+	}
+}
+
+void
+kmem_reap(void)
+{
+	struct kmem_cache *kc;
+
+	/* caches are never taken off the list, so it can be walked unlocked */
+	spinlock_acquire(&kmem_lock);
+	kc = kmem_caches;
+	spinlock_release(&kmem_lock);
+
+	for (; kc != NULL; kc = kc->kc_next) {
+		kmem_cache_reap(kc);
+	}
+}
+
+void
+kmem_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned hits, misses, i;
+
+	spinlock_acquire(&kmem_lock);
+	kc = kmem_caches;
+	spinlock_release(&kmem_lock);
+
+	kprintf("Object caches:\n");
+	kprintf("  %-12s %5s %9s %9s %5s %6s %9s\n", "cache", "size",
+		"hits", "misses", "hit", "depot", "destroyed");
+	for (; kc != NULL; kc = kc->kc_next) {
+		hits = misses = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			hits += kc->kc_cpu[i].kcc_hits;
+			misses += kc->kc_cpu[i].kcc_misses;
+		}
+		kprintf("  %-12s %5u %9u %9u %4u%% %6u %9u\n", kc->kc_name,
+			(unsigned)kc->kc_size, hits, misses,
+			hits + misses == 0 ? 0 :
+			(unsigned)((uint64_t)hits * 100 / (hits + misses)),
+			kc->kc_nfull * KMEM_MAGSIZE, kc->kc_destroyed);
+	}
+}
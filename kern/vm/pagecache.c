@@ -0,0 +1,305 @@
+/*
+ * Page cache for memory-mapped files (see pagecache.h).
+ *
+ * Cached pages are hashed on (vnode, offset) into pc_table. Each
+ * entry holds a reference to its vnode, so the file stays around while
+ * any of its pages are cached. Everything is done under pc_lock except
+ * reading a page in on a miss: the entry goes in the table marked busy
+ * first, and anyone else who wants that page waits on pc_cv until it
+ * is filled (or taken out again, if the read failed). Write-back is
+ * still done with pc_lock held; callers must not hold vnode or
+ * filesystem locks.
+ *
+ * The frames are ordinary kernel pages, so the evictor leaves them
+ * alone. Once more than PC_MAXPAGES pages are cached, a miss first
+ * drops every page nobody maps.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+#define PC_HASHSIZE	64
+#define PC_MAXPAGES	256
+
+struct pc_entry {
+	struct vnode *pe_vnode;
+	off_t pe_offset;
+	paddr_t pe_paddr;
+	bool pe_dirty;			/* mapped writable since last written */
+	bool pe_busy;			/* being read in, without pc_lock */
+	struct pc_entry *pe_next;	/* hash chain */
+};
+
+static struct lock *pc_lock;
+static struct cv *pc_cv;		/* a busy entry is done */
+static struct pc_entry *pc_table[PC_HASHSIZE];
+static unsigned pc_npages;
+
+void
+pagecache_bootstrap(void)
+{
+	pc_lock = lock_create("pagecache");
+	pc_cv = cv_create("pagecache");
+	if (pc_lock == NULL || pc_cv == NULL) {
+		panic("pagecache: Out of memory\n");
+	}
+}
+
+static
+unsigned
+pc_hash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(struct vnode *) +
+		(unsigned)(offset / PAGE_SIZE)) % PC_HASHSIZE;
+}
+
+static
+struct pc_entry *
+pc_find(struct vnode *v, off_t offset)
+{
+	struct pc_entry *pe;
+
+	for (pe = pc_table[pc_hash(v, offset)]; pe != NULL; pe = pe->pe_next) {
+		if (pe->pe_vnode == v && pe->pe_offset == offset) {
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take PE out of its hash chain.
+ */
+static
+void
+pc_unlink(struct pc_entry *pe)
+{
+	struct pc_entry **pp;
+
+	pp = &pc_table[pc_hash(pe->pe_vnode, pe->pe_offset)];
+	while (*pp != pe) {
+		pp = &(*pp)->pe_next;
+	}
+	*pp = pe->pe_next;
+}
+
+/*
+ * Read the page of V at OFFSET into the frame at PADDR, or write it
+ * back from there. Only the part inside the file is written.
+ */
+static
+int
+pc_io(struct vnode *v, off_t offset, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	size_t len = PAGE_SIZE;
+	int result;
+
+	if (rw == UIO_READ) {
+		/* short reads are the end of the file */
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+		uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), len,
+			  offset, UIO_READ);
+		return VOP_READ(v, &ku);
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (offset >= st.st_size) {
+		return 0;
+	}
+	if (st.st_size - offset < PAGE_SIZE) {
+		len = st.st_size - offset;
+	}
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), len,
+		  offset, UIO_WRITE);
+	result = VOP_WRITE(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Drop every page nobody maps. Called with pc_lock held.
+ */
+static
+unsigned
+pc_reclaim(void)
+{
+	struct pc_entry **pp, *pe;
+	unsigned i, n = 0;
+	int result;
+
+	for (i = 0; i < PC_HASHSIZE; i++) {
+		pp = &pc_table[i];
+		while ((pe = *pp) != NULL) {
+			if (pe->pe_busy || coremap_is_shared(pe->pe_paddr)) {
+				pp = &pe->pe_next;
+				continue;
+			}
+			if (pe->pe_dirty) {
+				result = pc_io(pe->pe_vnode, pe->pe_offset,
+					       pe->pe_paddr, UIO_WRITE);
+				if (result) {
+					kprintf("pagecache: write-back failed: "
+						"%s\n", strerror(result));
+				}
+			}
+			*pp = pe->pe_next;
+			free_kpages(PADDR_TO_KVADDR(pe->pe_paddr));
+			VOP_DECREF(pe->pe_vnode);
+			kfree(pe);
+			pc_npages--;
+			n++;
+		}
+	}
+	return n;
+}
+
+int
+pagecache_get(struct vnode *v, off_t offset, paddr_t *paddr, bool *readin)
+{
+	struct pc_entry *pe;
+	vaddr_t kva;
+	unsigned h;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	*readin = false;
+	lock_acquire(pc_lock);
+
+	/* someone else is reading it in: wait, then look again */
+	while ((pe = pc_find(v, offset)) != NULL && pe->pe_busy) {
+		cv_wait(pc_cv, pc_lock);
+	}
+	if (pe == NULL) {
+		if (pc_npages >= PC_MAXPAGES) {
+			pc_reclaim();
+		}
+
+		pe = kmalloc(sizeof(struct pc_entry));
+		if (pe == NULL) {
+			lock_release(pc_lock);
+			return ENOMEM;
+		}
+		kva = alloc_kpages(1);
+		if (kva == 0) {
+			kfree(pe);
+			lock_release(pc_lock);
+			return ENOMEM;
+		}
+
+		VOP_INCREF(v);
+		pe->pe_vnode = v;
+		pe->pe_offset = offset;
+		pe->pe_paddr = KVADDR_TO_PADDR(kva);
+		pe->pe_dirty = false;
+		pe->pe_busy = true;
+		h = pc_hash(v, offset);
+		pe->pe_next = pc_table[h];
+		pc_table[h] = pe;
+		pc_npages++;
+
+		lock_release(pc_lock);
+		result = pc_io(v, offset, pe->pe_paddr, UIO_READ);
+		lock_acquire(pc_lock);
+
+		pe->pe_busy = false;
+		cv_broadcast(pc_cv, pc_lock);
+		if (result) {
+			pc_unlink(pe);
+			pc_npages--;
+			free_kpages(kva);
+			VOP_DECREF(v);
+			kfree(pe);
+			lock_release(pc_lock);
+			return result;
+		}
+		*readin = true;
+	}
+
+	coremap_share(pe->pe_paddr);
+	*paddr = pe->pe_paddr;
+
+	lock_release(pc_lock);
+	return 0;
+}
+
+void
+pagecache_dirty(struct vnode *v, off_t offset)
+{
+	struct pc_entry *pe;
+
+	lock_acquire(pc_lock);
+	pe = pc_find(v, offset);
+	KASSERT(pe != NULL);
+	pe->pe_dirty = true;
+	lock_release(pc_lock);
+}
+
+int
+pagecache_flush(struct vnode *v)
+{
+	struct pc_entry *pe;
+	unsigned i;
+	int result, ret = 0;
+
+	lock_acquire(pc_lock);
+	for (i = 0; i < PC_HASHSIZE; i++) {
+		for (pe = pc_table[i]; pe != NULL; pe = pe->pe_next) {
+			/* busy pages are not mapped yet, so never dirty */
+			if (!pe->pe_dirty || (v != NULL && pe->pe_vnode != v)) {
+				continue;
+			}
+			result = pc_io(pe->pe_vnode, pe->pe_offset,
+				       pe->pe_paddr, UIO_WRITE);
+			if (result) {
+				if (ret == 0) {
+					ret = result;
+				}
+				continue;
+			}
+			/* still mapped: may be written again without a fault */
+			if (!coremap_is_shared(pe->pe_paddr)) {
+				pe->pe_dirty = false;
+			}
+		}
+	}
+	lock_release(pc_lock);
+
+	return ret;
+}
+
+unsigned
+pagecache_reclaim(void)
+{
+	unsigned n;
+
+	/* not set up yet, or memory ran out under our own write-back */
+	if (pc_lock == NULL || lock_do_i_hold(pc_lock)) {
+		return 0;
+	}
+
+	lock_acquire(pc_lock);
+	n = pc_reclaim();
+	lock_release(pc_lock);
+
+	return n;
+}
@@ -0,0 +1,145 @@
+/*
+ * Two-level user page tables (see pagetable.h).
+ *
+ * Entries are read and written by the address space's own thread;
+ * the only other writer is the evictor, which goes through the
+ * coremap and only touches entries whose frame it has pinned. So
+ * anything here that looks at a frame pins it first.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_DIRSIZE; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	paddr_t *table;
+	paddr_t pte;
+	unsigned i, j;
+
+	for (i = 0; i < PT_DIRSIZE; i++) {
+		table = pt->pt_dir[i];
+		if (table == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_TABLESIZE; j++) {
+			/* waits for the page if it is being swapped out */
+			pte = coremap_pin(&table[j], NULL, 0);
+			if (PTE_ISSWAPPED(pte)) {
+				swap_free(pte);
+			}
+			else if (PTE_ISRESIDENT(pte)) {
+				free_kpages(PADDR_TO_KVADDR(PTE_FRAME(pte)));
+			}
+		}
+		kfree(table);
+	}
+	kfree(pt);
+}
+
+paddr_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	paddr_t *table;
+	unsigned i;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	table = pt->pt_dir[PT_DIRINDEX(vaddr)];
+	if (table == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		table = kmalloc(PT_TABLESIZE * sizeof(paddr_t));
+		if (table == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_TABLESIZE; i++) {
+			table[i] = 0;
+		}
+		pt->pt_dir[PT_DIRINDEX(vaddr)] = table;
+	}
+	return &table[PT_TABLEINDEX(vaddr)];
+}
+
+unsigned
+pt_resident(struct pagetable *pt)
+{
+	paddr_t *table;
+	unsigned i, j, n;
+
+	n = 0;
+	for (i = 0; i < PT_DIRSIZE; i++) {
+		table = pt->pt_dir[i];
+		if (table == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_TABLESIZE; j++) {
+			if (PTE_ISRESIDENT(table[j])) {
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+int
+pt_copy(struct pagetable *new, struct pagetable *old)
+{
+	paddr_t *newtable, *oldtable;
+	paddr_t pte;
+	unsigned i, j;
+
+	for (i = 0; i < PT_DIRSIZE; i++) {
+		oldtable = old->pt_dir[i];
+		if (oldtable == NULL) {
+			continue;
+		}
+
+		/* the entry for the first page is the start of the table */
+		KASSERT(new->pt_dir[i] == NULL);
+		newtable = pt_lookup(new, (vaddr_t)i << 22, true);
+		if (newtable == NULL) {
+			return ENOMEM;
+		}
+
+		for (j = 0; j < PT_TABLESIZE; j++) {
+			pte = coremap_pin(&oldtable[j], NULL, 0);
+			if (PTE_ISSWAPPED(pte)) {
+				swap_share(pte);
+			}
+			else if (PTE_ISRESIDENT(pte)) {
+				/* writes to shared frames go through vm_fault */
+				pte &= ~PTE_TLBDIRTY;
+				oldtable[j] = pte;
+				coremap_share(PTE_FRAME(pte));
+				coremap_unpin(PTE_FRAME(pte));
+				/* nothing was preloaded for the child */
+				pte &= ~PTE_PREFETCH;
+			}
+			newtable[j] = pte;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Swap space (see swap.h).
+ *
+ * Slot i of the swap disk holds one page at byte offset i*PAGE_SIZE.
+ * swap_refcount[i] is 0 for a free slot, otherwise the number of page
+ * table entries naming it; it is protected by swap_lock. Finding a
+ * free slot is a scan starting where the last one was found.
+ *
+ * Eviction never holds a spinlock across the disk write; the victim
+ * frame stays pinned in the coremap instead (see coremap.c).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static struct vnode *swap_vnode;
+static unsigned *swap_refcount;
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static unsigned swap_hint;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	unsigned i;
+	int result;
+
+	/* vfs_open scribbles on its argument */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_refcount = kmalloc(swap_nslots * sizeof(unsigned));
+	if (swap_refcount == NULL) {
+		panic("swap: Out of memory\n");
+	}
+	for (i = 0; i < swap_nslots; i++) {
+		swap_refcount[i] = 0;
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+/*
+ * Grab a free slot. Returns -1 if swap is full.
+ */
+static
+int
+swap_alloc(void)
+{
+	unsigned i, slot;
+
+	spinlock_acquire(&swap_lock);
+	if (swap_nused == swap_nslots) {
+		spinlock_release(&swap_lock);
+		return -1;
+	}
+	for (i = 0; i < swap_nslots; i++) {
+		slot = (swap_hint + i) % swap_nslots;
+		if (swap_refcount[slot] == 0) {
+			break;
+		}
+	}
+	KASSERT(i < swap_nslots);
+	swap_refcount[slot] = 1;
+	swap_nused++;
+	swap_hint = slot + 1;
+	spinlock_release(&swap_lock);
+
+	return slot;
+}
+
+/*
+ * Read or write the page in slot SLOT from or to the frame at PADDR.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_evict(void)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	int slot, result;
+
+	/* the write sleeps: not from interrupts or under a spinlock */
+	if (swap_vnode == NULL || curthread->t_in_interrupt ||
+	    curthread->t_iplhigh_count > 0) {
+		return ENOMEM;
+	}
+
+	slot = swap_alloc();
+	if (slot < 0) {
+		return ENOSPC;
+	}
+
+	paddr = coremap_victim(&as, &vaddr);
+	if (paddr == 0) {
+		swap_free(SWAP_PTE(slot));
+		return ENOMEM;
+	}
+
+	/* nobody may write the page behind our back while it goes out */
+	vm_tlbinvalidate(as, vaddr);
+
+	result = swap_io(slot, paddr, UIO_WRITE);
+	if (result) {
+		kprintf("swap: write of slot %d failed: %s\n", slot,
+			strerror(result));
+		coremap_unpin(paddr);
+		swap_free(SWAP_PTE(slot));
+		return result;
+	}
+	vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+
+	coremap_evicted(paddr, SWAP_PTE(slot));
+	return 0;
+}
+
+int
+swap_pagein(paddr_t pte, paddr_t paddr)
+{
+	int result;
+
+	KASSERT(PTE_ISSWAPPED(pte));
+
+	result = swap_io(SWAP_SLOT(pte), paddr, UIO_READ);
+	if (result) {
+		return result;
+	}
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+
+	swap_free(pte);
+	return 0;
+}
+
+void
+swap_share(paddr_t pte)
+{
+	unsigned slot = SWAP_SLOT(pte);
+
+	KASSERT(PTE_ISSWAPPED(pte) && slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refcount[slot] > 0);
+	swap_refcount[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_free(paddr_t pte)
+{
+	unsigned slot = SWAP_SLOT(pte);
+
+	KASSERT(PTE_ISSWAPPED(pte) && slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refcount[slot] > 0);
+	swap_refcount[slot]--;
+	if (swap_refcount[slot] == 0) {
+		swap_nused--;
+	}
+	spinlock_release(&swap_lock);
+}
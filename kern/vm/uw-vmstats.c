@@ -8,17 +8,20 @@
  * (i.e., outside of these routines) by acquiring stats_lock.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
+ *
+ * The counts themselves live in struct cpu (c_vmstats), one array per
+ * cpu, and are summed when read. Incrementing only needs interrupts
+ * off (which holding stats_lock also gives), not the lock itself.
  */
 
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
-
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
 /* Strings used in printing out the statistics */
@@ -33,6 +36,14 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "TLB Replace (Random)",
+ /* 11 */ "TLB Replace (Round-robin)",
+ /* 12 */ "TLB Replace (Clock)",
+ /* 13 */ "TLB Clock Second Chances",
+ /* 14 */ "Page Faults from mmap File",
+ /* 15 */ "TLB Fault-around Loads",
+ /* 16 */ "TLB Fault-around Replace",
+ /* 17 */ "TLB Fault-around Refaults",
 };
 
 
@@ -41,9 +52,12 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    int spl;
+
+    /* no lock: nobody else writes this cpu's counters */
+    spl = splhigh();
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +79,7 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  curcpu->c_vmstats[index]++;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -73,6 +87,7 @@ void
 _vmstats_init(void)
 {
   int i = 0;
+  unsigned int n, c;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -80,12 +95,36 @@ _vmstats_init(void)
     panic("Should really fix this before proceeding\n");
   }
 
-  for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+  n = cpu_numcpus();
+  for (c=0; c<n; c++) {
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      cpu_getbynumber(c)->c_vmstats[i] = 0;
+    }
   }
 
 }
 
+/* ---------------------------------------------------------------------- */
+/* Other cpus keep counting while we add up, so this is only a snapshot */
+void
+vmstats_read(unsigned int counts[VMSTAT_COUNT])
+{
+  int i = 0;
+  unsigned int n, c;
+  struct cpu *cpu;
+
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    counts[i] = 0;
+  }
+  n = cpu_numcpus();
+  for (c=0; c<n; c++) {
+    cpu = cpu_getbynumber(c);
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      counts[i] += cpu->c_vmstats[i];
+    }
+  }
+}
+
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
 /* NOTE: We do not grab the spinlock here because kprintf may block
@@ -102,6 +141,12 @@ vmstats_print(void)
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  unsigned int policy_replace = 0;
+  unsigned int all_replace = 0;
+  unsigned int prefetch_used = 0;
+  unsigned int stats_counts[VMSTAT_COUNT];
+
+  vmstats_read(stats_counts);
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -112,7 +157,8 @@ vmstats_print(void)
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
     stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ] +
+    stats_counts[VMSTAT_MMAP_FILE_READ];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
@@ -128,9 +174,24 @@ vmstats_print(void)
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
+  policy_replace = stats_counts[VMSTAT_TLB_REPLACE_RANDOM] +
+    stats_counts[VMSTAT_TLB_REPLACE_ROUNDROBIN] + stats_counts[VMSTAT_TLB_REPLACE_CLOCK];
+  all_replace = stats_counts[VMSTAT_TLB_FAULT_REPLACE] + stats_counts[VMSTAT_TLB_FAULTAROUND_REPLACE];
+  if (all_replace != policy_replace) {
+    kprintf("WARNING: TLB Faults with Replace + TLB Fault-around Replace (%u) != sum of per-policy replacements (%u)\n",
+      all_replace, policy_replace);
+  }
+
+  /* a preloaded entry that is missed again before the page faults for
+   * any other reason most likely went unused */
+  if (stats_counts[VMSTAT_TLB_FAULTAROUND] >= stats_counts[VMSTAT_TLB_FAULTAROUND_REFAULT]) {
+    prefetch_used = stats_counts[VMSTAT_TLB_FAULTAROUND] - stats_counts[VMSTAT_TLB_FAULTAROUND_REFAULT];
+  }
+  kprintf("VMSTAT TLB Fault-around Loads - TLB Fault-around Refaults (used) = %u\n", prefetch_used);
+
+  kprintf("VMSTAT ELF File reads + Swapfile reads + mmap File reads = %d\n", elf_plus_swap_reads);
   if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
+    kprintf("WARNING: ELF File reads + Swapfile reads + mmap File reads != Page Faults (Disk) %d\n",
       elf_plus_swap_reads);
   }
 }
@@ -0,0 +1,80 @@
+/*
+ * vm-mmap.c
+ *
+ * Checks anonymous mmap and munmap: a new mapping reads back as
+ * zeros, writes to it stick, munmap of part of a mapping fails, and
+ * touching the mapping once it is unmapped kills the process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (8)
+#define SIZE      (PAGE_SIZE * PAGES)
+
+static
+void
+check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAILED %s\n", what);
+		exit(1);
+	}
+}
+
+int
+main()
+{
+	volatile unsigned char *p;
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	p = mmap(NULL, SIZE, PROT_READ | PROT_WRITE,
+		 MAP_ANON | MAP_PRIVATE, -1, 0);
+	check(p != MAP_FAILED, "mmap");
+
+	for (i = 0; i < SIZE; i++) {
+		if (p[i] != 0) {
+			printf("FAILED p[%u] = %u, not zero\n", i, p[i]);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < SIZE; i++) {
+		p[i] = i % 251;
+	}
+	for (i = 0; i < SIZE; i++) {
+		if (p[i] != i % 251) {
+			printf("FAILED p[%u] = %u != %u\n", i, p[i], i % 251);
+			exit(1);
+		}
+	}
+
+	check(munmap((void *)p, PAGE_SIZE) == -1 && errno == EINVAL,
+	      "munmap of the first page did not give EINVAL");
+	check(munmap((void *)(p + PAGE_SIZE), SIZE - PAGE_SIZE) == -1 &&
+	      errno == EINVAL, "munmap of the tail did not give EINVAL");
+	check(p[SIZE - 1] == (SIZE - 1) % 251,
+	      "mapping changed by a failed munmap");
+
+	check(munmap((void *)p, SIZE) == 0, "munmap");
+
+	pid = fork();
+	check(pid >= 0, "fork");
+	if (pid == 0) {
+		i = p[0];
+		printf("IF THIS PRINTS THE TEST FAILED (read %u)\n", i);
+		_exit(0);
+	}
+	check(waitpid(pid, &status, 0) == pid, "waitpid");
+	check(!WIFEXITED(status) || WEXITSTATUS(status) != 0,
+	      "unmapped memory could still be read");
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}